@@ -10,34 +10,52 @@
 //This C program initializes a file to an empty filesystem. I.e. to the state, where the filesystem can be mounted and other files and directories can be created under the root inode. The program receives three arguments: the raid mode, disk image file (multiple times), the number of inodes in the filesystem, and the number of data blocks in the system. The number of blocks should always be rounded up to the nearest multiple of 32 to prevent the data structures on disk from being misaligned. For example:
 
 //./mkfs -r 1 -d disk.img -d disk1.img -i 32 -b 200
+//An optional -B sets the data block size in bytes, a power of two from 512 (the default) to 65536.
+//An optional -f picks how new files map their blocks: classic (the default), extent, or indirect3 (double and triple indirect blocks).
+//An optional -I keeps files small enough to fit in their inode inline, without a data block.
+//An optional -H gives directories a hashed index, so lookups in large directories read one block.
+//An optional -J <blocks> lays out a metadata journal of that many 512 byte blocks after the superblock.
+//An optional -A 4k|2m starts the inode and data regions on a page (or huge page) boundary, so blocks don't straddle pages.
 //initializes all disks (disk1 and disk2) to an empty filesystem with 32 inodes and 224 data blocks. The size of the inode and data bitmaps are determined by the number of blocks specified by mkfs. If mkfs finds that the disk image file is too small to accommodate the number of blocks, it should exit with return code -1. mkfs should write the superblock and root inode to the disk image./
 
 
 static int disk_order = 1;
 
 
-int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, int raid_mode){
+int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, int raid_mode, int block_size, int inode_format, int inline_data, int dir_index, int journal_blocks, int align){
 
 	time_t t_result;
 	for(int i = 0; i < num_disks; i++){
 		// INIT THE SUPER BLOCK 
-		struct wfs_sb * superblock = malloc(sizeof(struct wfs_sb)); 	
+		struct wfs_sb * superblock = calloc(1, sizeof(struct wfs_sb)); // Padding reads as defaults
 		superblock->num_inodes = num_inodes;
 		superblock->num_data_blocks = num_datablocks;
 		superblock->i_bitmap_ptr = sizeof(struct wfs_sb);
+		// the journal sits between the superblock and the bitmaps
+		if(journal_blocks > 0) superblock->i_bitmap_ptr = JOURNAL_PTR + ((off_t)BLOCK_SIZE * journal_blocks);
 
         int i_bitmap_size = num_inodes /8;
         int d_bitmap_size = num_datablocks /8;
 		superblock->d_bitmap_ptr = superblock->i_bitmap_ptr + (i_bitmap_size);
 
-		//inode offset is a multiple of 512
-		off_t inode_offset = sizeof(struct wfs_sb) + (i_bitmap_size) + (d_bitmap_size);
-		int remainder = inode_offset % 512;
-		if(remainder != 0) inode_offset = inode_offset + (512 - remainder);
+		//inode offset is a multiple of 512, or of the alignment asked for
+		int inode_align = (align > 512) ? align : 512;
+		off_t inode_offset = superblock->i_bitmap_ptr + (i_bitmap_size) + (d_bitmap_size);
+		int remainder = inode_offset % inode_align;
+		if(remainder != 0) inode_offset = inode_offset + (inode_align - remainder);
 		superblock->i_blocks_ptr = inode_offset;
 
+		// data blocks start on a multiple of the block size, or of the alignment if that is larger
+		int data_align = (align > block_size) ? align : block_size;
 		off_t datablocks_offset = inode_offset + (512 * num_inodes);
+		remainder = datablocks_offset % data_align;
+		if(remainder != 0) datablocks_offset = datablocks_offset + (data_align - remainder);
 		superblock->d_blocks_ptr = datablocks_offset;	
+		superblock->block_size = block_size;
+		superblock->inode_format = inode_format;
+		superblock->inline_data = inline_data;
+		superblock->dir_index = dir_index;
+		superblock->journal_blocks = journal_blocks;
 
 		superblock->raid_mode = raid_mode;
 		superblock->total_disks = num_disks;
@@ -59,6 +77,10 @@ int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, i
 			root_inode->blocks[i] = -1;
 		}
 
+		// The slack after the root inode says how the root directory is laid out
+		struct wfs_inode_ext root_ext = {0};
+		root_ext.format = dir_index ? INODE_HASHED_DIR : INODE_INDIRECT_DIR;
+
 		
 		t_result = time(NULL);
 		root_inode->atim = t_result; 
@@ -72,6 +94,22 @@ int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, i
 			exit(-1);
 		};
 		
+		// an empty journal, every block of it zeroed so no old transaction replays
+		if(journal_blocks > 0){
+			unsigned char journal_block[BLOCK_SIZE] = {0};
+			struct wfs_journal_header header = {JOURNAL_HEADER, 1, 1, 0};
+			for(int b = 0; b < journal_blocks; b++){
+				if(b == 0) memcpy(journal_block, &header, sizeof(header));
+				else memset(journal_block, 0, BLOCK_SIZE);
+				if(pwrite(disks[i], journal_block, BLOCK_SIZE, JOURNAL_PTR + (off_t)BLOCK_SIZE * b) == -1){
+					printf("failed to write journal to disk[%d]: %d\n", i, disks[i]);
+					free(superblock);
+					free(root_inode);
+					exit(-1);
+				}
+			}
+		}
+
 		if(lseek(disks[i], superblock->i_blocks_ptr, SEEK_SET) == -1){
 			printf("failed to lseek()\n");
 			free(superblock);
@@ -84,6 +122,12 @@ int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, i
 			free(root_inode);
 			exit(-1);
 		};
+
+        if(write(disks[i], &root_ext, sizeof(struct wfs_inode_ext)) == -1){ printf("failed to write root_inode to disk[%d]: %d\n", i, disks[i]);
+			free(superblock);
+			free(root_inode);
+			exit(-1);
+		};
 		
 
 		if(lseek(disks[i], superblock->i_bitmap_ptr, SEEK_SET) == -1){
@@ -106,8 +150,9 @@ int init_disks(int * disks, int num_disks, int num_inodes, int num_datablocks, i
 			exit(-1);
 		};
 
-		int file_size = lseek(disks[i], 0, SEEK_END);
-		if(file_size <= ((512 * num_datablocks) + (512 * num_inodes))){
+		// the data region has to end inside the image, padding included
+		off_t file_size = lseek(disks[i], 0, SEEK_END);
+		if(file_size < superblock->d_blocks_ptr + ((off_t)block_size * num_datablocks)){
 			printf("too many blocks");
 			free(superblock);
 			free(root_inode);
@@ -137,6 +182,12 @@ int main(int argc, char *argv[])
 	int * disks = NULL;
 	int num_inodes = -1;
 	int num_datablocks = -1;
+	int block_size = -1;
+	int inode_format = -1;
+	int inline_data = 0;
+	int dir_index = 0;
+	int journal_blocks = 0;
+	int align = 0;
 	for(int i = 0; i < argc; i++){
 
 		if(argv[i][0] == '-'){
@@ -146,7 +197,12 @@ int main(int argc, char *argv[])
 					printf("multiple arguments for raid\n");
 					exit(-1);
 				}		
-				raid_mode = atoi(argv[i + 1]);
+				if(strcmp(argv[i + 1], "1v") == 0){
+					raid_mode = RAID_1V;
+				} else {
+					raid_mode = atoi(argv[i + 1]);
+					if(raid_mode > 1) raid_mode = -2; // 1v is only spelled 1v
+				}
 				i++;
 				continue;
 			}
@@ -200,6 +256,68 @@ int main(int argc, char *argv[])
 				continue;
 
 			}
+
+			if(argv[i][1] == 'B'){
+				
+				if(block_size != -1){
+					printf("multiple arguments for block_size\n");
+					free(disks);
+					exit(-1);
+				}		
+				block_size = atoi(argv[i + 1]);
+				i++;
+				continue;
+
+			}
+
+			if(argv[i][1] == 'I'){
+				inline_data = 1;
+				continue;
+			}
+
+			if(argv[i][1] == 'H'){
+				dir_index = 1;
+				continue;
+			}
+
+			if(argv[i][1] == 'J'){
+				journal_blocks = atoi(argv[i + 1]);
+				i++;
+				continue;
+			}
+
+			if(argv[i][1] == 'A'){
+				if(strcmp(argv[i + 1], "4k") == 0){
+					align = 4096;
+				} else if(strcmp(argv[i + 1], "2m") == 0){
+					align = 2 * 1024 * 1024;
+				} else {
+					align = -1;
+				}
+				i++;
+				continue;
+			}
+
+			if(argv[i][1] == 'f'){
+				
+				if(inode_format != -1){
+					printf("multiple arguments for inode format\n");
+					free(disks);
+					exit(-1);
+				}		
+				if(strcmp(argv[i + 1], "classic") == 0){
+					inode_format = INODE_CLASSIC;
+				} else if(strcmp(argv[i + 1], "extent") == 0){
+					inode_format = INODE_EXTENT;
+				} else if(strcmp(argv[i + 1], "indirect3") == 0){
+					inode_format = INODE_INDIRECT3;
+				} else {
+					inode_format = -2;
+				}
+				i++;
+				continue;
+
+			}
 		}
 	}	
 
@@ -209,13 +327,41 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	if((raid_mode < 0) | (raid_mode > 1)){
+	if((raid_mode < 0) | (raid_mode > RAID_1V)){
 		printf("invalid raid mode");
 		free(disks);
 		exit(1);
 	}
 
-	init_disks(disks, num_disks, num_inodes, num_datablocks, raid_mode);
+	// block size must be a power of two between 512 and 64KiB
+	if(block_size == -1) block_size = BLOCK_SIZE;
+	if((block_size < BLOCK_SIZE) | (block_size > MAX_BLOCK_SIZE) | ((block_size & (block_size - 1)) != 0)){
+		printf("invalid block size");
+		free(disks);
+		exit(1);
+	}
+
+	if(inode_format == -1) inode_format = INODE_CLASSIC;
+	if(inode_format < 0){
+		printf("invalid inode format");
+		free(disks);
+		exit(1);
+	}
+
+	// a journal needs its header and room for a transaction
+	if((journal_blocks < 0) | ((journal_blocks > 0) & (journal_blocks < 8))){
+		printf("invalid journal size");
+		free(disks);
+		exit(1);
+	}
+
+	if(align < 0){
+		printf("invalid alignment, expected 4k or 2m");
+		free(disks);
+		exit(1);
+	}
+
+	init_disks(disks, num_disks, num_inodes, num_datablocks, raid_mode, block_size, inode_format, inline_data, dir_index, journal_blocks, align);
     free(disks);
 	exit(0);
 }
@@ -1,4 +1,5 @@
 #define FUSE_USE_VERSION 30
+#define _GNU_SOURCE // sync_file_range
 #define FILE_NAME_MAX 28
 /*
   FUSE: Filesystem in Userspace
@@ -11,6 +12,7 @@
 */
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,2127 +26,6782 @@
 #include <sys/mman.h>
 #include "wfs.h"
 #include <stdint.h>
-
-static int raid_mode;
-static int *disks;
-static int *disk_size;
-static unsigned char **mappings;
-static int numdisks = 0;
-static struct wfs_sb **superblocks;
-static struct wfs_inode **roots;
-static int next_disk = 0;
-
-struct PathListNode
+#include <endian.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// ------------LOGGING-----------------
+// Messages above WFS_LOG_LEVEL compile to nothing, build with
+// -DWFS_LOG_LEVEL=3 to see every request
+#define LEVEL_ERROR (0) // Something failed that the caller can't fix
+#define LEVEL_WARN	(1) // Something ran out or fell back to a slower path
+#define LEVEL_INFO	(2) // Mount, unmount and recovery
+#define LEVEL_DEBUG (3) // Per request and per block
+#ifndef WFS_LOG_LEVEL
+#define WFS_LOG_LEVEL LEVEL_WARN
+#endif
+#define LOG(level, ...)                  \
+	do                                   \
+	{                                    \
+		if ((level) <= WFS_LOG_LEVEL)    \
+		{                                \
+			printf(__VA_ARGS__);         \
+		}                                \
+	} while (0)
+#define LOG_ERROR(...) LOG(LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG(LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG(LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LEVEL_DEBUG, __VA_ARGS__)
+
+// Trace ring, the last TRACE_SLOTS events kept in memory whatever the log
+// level and written to stderr on SIGUSR1. Events are a format with up to
+// three %ld arguments, formatted only when dumped. -DWFS_TRACE=0 compiles
+// them out
+#ifndef WFS_TRACE
+#define WFS_TRACE (1)
+#endif
+#if WFS_TRACE
+#define TRACE_SLOTS (4096) // Power of two
+#define TRACE(fmt, a, b, c) traceEvent(fmt, (long)(a), (long)(b), (long)(c))
+
+struct TraceRecord
 {
-	char *data;
-	struct PathListNode *next;
+	uint64_t seq; // Event number + 1 once written, 0 while it's being written
+	uint64_t nsec;
+	const char *fmt;
+	long args[3];
 };
 
-typedef struct
-{
-	char **path_components;
-	int size;
-} Path;
+static struct TraceRecord trace_ring[TRACE_SLOTS];
+static uint64_t trace_head; // Events ever recorded
 
-struct IndirectBlock
+static void traceEvent(const char *fmt, long a, long b, long c)
 {
-	off_t blocks[BLOCK_SIZE / sizeof(off_t)];
-};
-
-// ------------HELPTER FUNCINTS-----------------
-// entry is the encoded values. This returns the block offset;
-static int getEntryOffset(int entry) {
-	int ret_val = entry;
-	entry = entry % BLOCK_SIZE;
-	ret_val-= entry;
-	return ret_val;
-}
-
-// returns teh disk for  given entry
-static int getEntryDisk(int entry) {
-	int ret_val = entry % BLOCK_SIZE;
-	return ret_val;
+	struct timespec now;
+	uint64_t event = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	struct TraceRecord *record = &trace_ring[event % TRACE_SLOTS];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	__atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	record->nsec = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	record->fmt = fmt;
+	record->args[0] = a;
+	record->args[1] = b;
+	record->args[2] = c;
+	__atomic_store_n(&record->seq, event + 1, __ATOMIC_RELEASE);
 }
 
-// tshi returnst eh next disk and updates it
-static int getNextDisk() {
-	int ret_val = next_disk;
-	next_disk= (next_disk + 1) % numdisks;
-	return ret_val;
-}
-static int checkDBitmap(unsigned int inum, int disk)
+// Appends value in decimal, the dump can't use stdio from a signal handler
+static size_t traceNumber(char *line, size_t len, size_t cap, long value)
 {
-	int byte_dist = inum / 8;		 // how many byes away from start inum is
-	unsigned char offset = inum % 8; // We want to start at lower bits
-	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
-	unsigned char bit_val;
+	char digits[24];
+	int count = 0;
+	unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
 
-	data_bitmap += byte_dist; // Go byte_dist bytes over
-	bit_val = *data_bitmap;
-	bit_val &= (1 << offset); // Shift over offset times
-	if (bit_val > 0)
+	do
 	{
-		return 1;
+		digits[count++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0 && len < cap)
+	{
+		line[len++] = '-';
 	}
-	else
+	while (count > 0 && len < cap)
 	{
-		return 0;
+		line[len++] = digits[--count];
 	}
+	return len;
 }
 
-static int checkIBitmap(unsigned int inum, int disk)
+/** traceDump
+ * Writes the ring out oldest first, one "<usec> <event>" line per event.
+ * Only uses write, so it's safe in a signal handler. Records overwritten
+ * while it reads them are skipped
+ **/
+static void traceDump(int fd)
 {
-
-	int byte_dist = inum / 8;		 // how many byes away from start inum is
-	unsigned char offset = inum % 8; // We want to start at lower bits
-	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
-	unsigned char bit_val;
-
-	inode_bitmap += byte_dist; // Go byte_dist bytes over
-	bit_val = *inode_bitmap;
-	bit_val &= (1 << offset); // Shift over offset times
-	if (bit_val > 0)
-	{
-		return 1;
-	}
-	else
+	char line[256];
+	size_t len;
+	int arg;
+	struct TraceRecord record;
+	uint64_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint64_t first = head > TRACE_SLOTS ? head - TRACE_SLOTS : 0;
+
+	for (uint64_t event = first; event < head; event++)
 	{
-		return 0;
+		struct TraceRecord *slot = &trace_ring[event % TRACE_SLOTS];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != event + 1)
+		{
+			continue;
+		}
+		record = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != event + 1)
+		{
+			continue;
+		}
+
+		len = traceNumber(line, 0, sizeof(line) - 1, (long)(record.nsec / 1000));
+		line[len++] = ' ';
+		arg = 0;
+		for (const char *f = record.fmt; *f != '\0' && len < sizeof(line) - 1; f++)
+		{
+			if (f[0] == '%' && f[1] == 'l' && f[2] == 'd' && arg < 3)
+			{
+				len = traceNumber(line, len, sizeof(line) - 1, record.args[arg++]);
+				f += 2;
+			}
+			else
+			{
+				line[len++] = *f;
+			}
+		}
+		line[len++] = '\n';
+		if (write(fd, line, len) < 0)
+		{
+			return;
+		}
 	}
 }
 
-static int markbitmap_d(unsigned int bnum, int used, int disk)
+static void traceSignal(int sig)
 {
+	traceDump(STDERR_FILENO);
+}
+#else
+#define TRACE(fmt, a, b, c) \
+	do                      \
+	{                       \
+		(void)(a);          \
+		(void)(b);          \
+		(void)(c);          \
+	} while (0)
+#endif
+
+// ------------STATS-----------------
+// Counts, bytes and latency histograms per operation, read from the virtual
+// file /.wfs_stats and written to stderr on unmount. -DWFS_STATS=0 compiles
+// the timing out
+#ifndef WFS_STATS
+#define WFS_STATS (1)
+#endif
+#define STATS_NAME ".wfs_stats" // In the root directory, never on disk or in readdir
+#define STAT_GETATTR (0)
+#define STAT_LOOKUP	 (1) // Low-level backend only
+#define STAT_READ	 (2)
+#define STAT_WRITE	 (3)
+#define STAT_READDIR (4)
+#define STAT_MKNOD	 (5)
+#define STAT_MKDIR	 (6)
+#define STAT_CREATE	 (7)
+#define STAT_UNLINK	 (8)
+#define STAT_RMDIR	 (9)
+#define STAT_OPEN	 (10)
+#define STAT_RELEASE (11)
+#define STAT_FSYNC	 (12)
+#define STAT_FLUSH	 (13)
+#define STAT_ALLOC	 (14) // Internals, their time is part of the operations above
+#define STAT_PATH	 (15)
+#define STAT_DIRSCAN (16)
+#define STAT_COUNT	 (17)
+#define STAT_BUCKETS (40) // Bucket b holds latencies up to 2^b ns, the last everything longer
+
+struct OpStats
+{
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STAT_BUCKETS];
+};
 
-	int byte_dist = bnum / 8;		 // how many byes away from start bnum is
-	unsigned char offset = bnum % 8; // We want to start at lower bits
-	unsigned char *blocks_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+// A /.wfs_stats open file, what it reads is fixed when it's opened
+struct StatsSnapshot
+{
+	char *text;
+	size_t len;
+};
 
-	blocks_bitmap += byte_dist; // Go byte_dist bytes over
-	// mark it 0
-	if (used != 1)
-	{
-		unsigned char mask = 1;
-		mask = mask << offset;
-		mask = ~mask;
-		*blocks_bitmap &= mask;
-		return 0;
-	}
-	// mark it one
-	*blocks_bitmap = *blocks_bitmap | used << offset;
+#if WFS_STATS
+static struct OpStats op_stats[STAT_COUNT];
+static const char *const stat_names[STAT_COUNT] = {
+	"getattr", "lookup", "read", "write", "readdir", "mknod", "mkdir", "create", "unlink",
+	"rmdir", "open", "release", "fsync", "flush", "allocateBlock", "getInodePath", "searchDir"};
+#endif
 
+static uint64_t statStart()
+{
+#if WFS_STATS
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#else
 	return 0;
+#endif
 }
 
-static int markbitmap_i(unsigned int inum, int used, int disk)
+// Records one op that began at start and moved bytes
+static void statEnd(int op, uint64_t start, long bytes)
 {
-
-	int byte_dist = inum / 8;		 // how many bytes away from start inum is
-	unsigned char offset = inum % 8; // We want to start at lower bits
-	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
-
-	inode_bitmap += byte_dist; // Go byte_dist bytes over
-	if (used != 1)
+#if WFS_STATS
+	uint64_t ns = statStart() - start;
+	struct OpStats *stats = &op_stats[op];
+	int bucket = ns == 0 ? 0 : MIN(64 - __builtin_clzll(ns), STAT_BUCKETS - 1);
+	uint64_t max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+	if (bytes > 0)
 	{
-		unsigned char mask = 1;
-		mask = mask << offset;
-		mask = ~mask;
-		*inode_bitmap &= mask;
-		return 0;
+		__atomic_add_fetch(&stats->bytes, bytes, __ATOMIC_RELAXED);
 	}
-	*inode_bitmap = *inode_bitmap | (unsigned char)used << offset;
-	return 0;
+	__atomic_add_fetch(&stats->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats->buckets[bucket], 1, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&stats->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+#endif
 }
 
-static int findFreeInode(int disk)
+#if WFS_STATS
+// Upper bound of the bucket the fraction-th latency falls in
+static uint64_t statPercentile(const uint64_t *buckets, uint64_t count, double fraction)
 {
+	uint64_t seen = 0;
 
-	// Iterate over all entries until one that isnt mapped is found
-	for (int i = 0; i < (int)superblocks[disk]->num_inodes; i++)
+	for (int b = 0; b < STAT_BUCKETS; b++)
 	{
-		if (checkIBitmap(i, disk) == 0)
+		seen += buckets[b];
+		if (seen > 0 && seen >= fraction * count)
 		{
-			return i;
+			return (uint64_t)1 << b;
 		}
 	}
-	return -1; // Return -1 if no open mappings are found
+	return (uint64_t)1 << (STAT_BUCKETS - 1);
 }
+#endif
 
-static int findFreeData(int disk)
+/** renderStats
+ * Formats every operation seen so far as a table, then the nonzero buckets
+ * of each as upper bound in ns:count. Counters are read one at a time, so a
+ * row can be a few operations out of step with itself. Returns a malloced
+ * string, NULL when out of memory
+ **/
+static char *renderStats(size_t *len)
 {
+	char *text = NULL;
+	FILE *out = open_memstream(&text, len);
+
+	if (out == NULL)
+	{
+		return NULL;
+	}
+#if WFS_STATS
+	struct OpStats snap;
 
-	// Iterate over all entries until one that isnt mapped is found
-	for (int i = 0; i < (int)superblocks[disk]->num_data_blocks; i++)
+	fprintf(out, "%-13s %10s %14s %10s %10s %10s %10s %12s\n", "op", "count", "bytes", "avg_ns",
+			"p50_ns", "p99_ns", "p999_ns", "max_ns");
+	for (int op = 0; op < STAT_COUNT; op++)
 	{
-		if (checkDBitmap(i, disk) == 0)
+		snap.count = __atomic_load_n(&op_stats[op].count, __ATOMIC_RELAXED);
+		if (snap.count == 0)
+		{
+			continue;
+		}
+		snap.bytes = __atomic_load_n(&op_stats[op].bytes, __ATOMIC_RELAXED);
+		snap.total_ns = __atomic_load_n(&op_stats[op].total_ns, __ATOMIC_RELAXED);
+		snap.max_ns = __atomic_load_n(&op_stats[op].max_ns, __ATOMIC_RELAXED);
+		for (int b = 0; b < STAT_BUCKETS; b++)
 		{
-			return i;
+			snap.buckets[b] = __atomic_load_n(&op_stats[op].buckets[b], __ATOMIC_RELAXED);
 		}
+		fprintf(out, "%-13s %10lu %14lu %10lu %10lu %10lu %10lu %12lu\n", stat_names[op],
+				(unsigned long)snap.count, (unsigned long)snap.bytes, (unsigned long)(snap.total_ns / snap.count),
+				(unsigned long)statPercentile(snap.buckets, snap.count, 0.5),
+				(unsigned long)statPercentile(snap.buckets, snap.count, 0.99),
+				(unsigned long)statPercentile(snap.buckets, snap.count, 0.999), (unsigned long)snap.max_ns);
 	}
-	return -1; // Return -1 if no open mappings are found
+	for (int op = 0; op < STAT_COUNT; op++)
+	{
+		if (__atomic_load_n(&op_stats[op].count, __ATOMIC_RELAXED) == 0)
+		{
+			continue;
+		}
+		fprintf(out, "%s", stat_names[op]);
+		for (int b = 0; b < STAT_BUCKETS; b++)
+		{
+			uint64_t n = __atomic_load_n(&op_stats[op].buckets[b], __ATOMIC_RELAXED);
+			if (n > 0)
+			{
+				fprintf(out, " %lu:%lu", (unsigned long)1 << b, (unsigned long)n);
+			}
+		}
+		fprintf(out, "\n");
+	}
+#else
+	fprintf(out, "wfs was built with WFS_STATS=0\n");
+#endif
+	if (fclose(out) != 0)
+	{
+		free(text);
+		return NULL;
+	}
+	return text;
 }
 
-/** allocateBlock
- * Finds an open block on the given disk and then returns its offset
- **/
-static int allocateBlock(int disk)
+// Takes the snapshot a /.wfs_stats open reads
+static struct StatsSnapshot *openStats()
 {
-	int ret_val;
-	int data_bit;
+	struct StatsSnapshot *snapshot = malloc(sizeof(struct StatsSnapshot));
 
-	// Find open spot
-	data_bit = findFreeData(disk);
-	if (data_bit == -1)
+	if (snapshot == NULL)
 	{
-		return -1;
+		return NULL;
 	}
-
-	ret_val = BLOCK_SIZE * data_bit; // Offset is 512 * data_bit
-
-	// Initialize new block to zero
-	memset((unsigned char *)mappings[disk] + superblocks[disk]->d_blocks_ptr + ret_val, 0, BLOCK_SIZE);
-
-	markbitmap_d(data_bit, 1, disk); // Mark this as allocated
-	if(raid_mode == 0) {
-		ret_val +=disk;
+	snapshot->text = renderStats(&snapshot->len);
+	if (snapshot->text == NULL)
+	{
+		free(snapshot);
+		return NULL;
 	}
-	return ret_val;					 // Returns first entry within block
+	return snapshot;
 }
 
-// initializeIndirectBlock
-// allocates a block for the indirect block and initialies all its pointers to -1
-static int initializeIndirectBlock(int disk){
-	// allocate the first block
-	printf("initalizeIndirectBlock()\n");
-	int indirectBlock_offset = allocateBlock(disk);
-	struct IndirectBlock *indirectBlock	= (struct IndirectBlock *)(mappings[disk] + superblocks[disk]->d_blocks_ptr + indirectBlock_offset);
-	for(int i = 0; i < (BLOCK_SIZE / sizeof(off_t)); i++){
-		indirectBlock->blocks[i] = -1;
-	}
-	return indirectBlock_offset;
-
+static void closeStats(struct StatsSnapshot *snapshot)
+{
+	free(snapshot->text);
+	free(snapshot);
 }
 
-
-/** allocateInode
- * Finds an open inode and then returns its offset from inode ptr
- **/
-static struct wfs_inode *allocateInode(int disk)
+// Copies what's left of a snapshot at offset into buf
+static int readStats(struct StatsSnapshot *snapshot, char *buf, size_t size, off_t offset)
 {
-	int ret_val;
-	int data_bit;
-
-	data_bit = findFreeInode(disk);
-	if (data_bit == -1)
+	if (offset >= (off_t)snapshot->len)
 	{
-		return NULL;
+		return 0;
 	}
+	size = MIN(size, snapshot->len - offset);
+	memcpy(buf, snapshot->text + offset, size);
+	return size;
+}
 
-	ret_val = BLOCK_SIZE * data_bit;
-	markbitmap_i(data_bit, 1, disk);
+static int isStatsPath(const char *path)
+{
+	return path != NULL && path[0] == '/' && strcmp(path + 1, STATS_NAME) == 0;
+}
 
-	// Initialize inode
-	struct wfs_inode *my_inode;
-	my_inode = (struct wfs_inode *)((char *)mappings[disk] + superblocks[disk]->i_blocks_ptr + ret_val);
-	my_inode->mode = 0x777; // RW for UGO
-	my_inode->num = data_bit;
-	my_inode->uid = getuid();
-	my_inode->gid = getgid();
-	my_inode->size = 0; 
-	my_inode->nlinks = 0;
-	my_inode->atim = time(0);
-	my_inode->mtim = time(0);
-	my_inode->ctim = time(0);
-	for (int i = 0; i < N_BLOCKS; i++)
-	{
-		my_inode->blocks[i] = -1;
-	}
-	return my_inode;
+// A read-only regular file with no size, opened direct_io so reads aren't
+// cut off at st_size
+static void statsStat(struct stat *stbuf, ino_t ino)
+{
+	memset(stbuf, 0, sizeof(*stbuf));
+	stbuf->st_ino = ino;
+	stbuf->st_mode = S_IFREG | 0444;
+	stbuf->st_nlink = 1;
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
 }
 
-/** splitPath
- * Returns a Path struct which will contain an array of each entry in the path
- **/
-static Path *splitPath(char *path)
+static int raid_mode;
+static int *disks;
+static off_t *disk_size;
+static int *mount_index; // Per disk, its position among the images on the command line
+static unsigned char **mappings;
+static unsigned char **data_mappings; // Shared views for file data and the journal, see mapDisks
+static int numdisks = 0;
+static struct wfs_sb **superblocks;
+static struct wfs_inode **roots;
+static int *next_free_inode; // Per disk bit to start the next inode search at
+static int *next_free_data;	 // Per disk bit to start the next data block search at
+#define ALLOC_NEXT_FIT (-1) // Allocation goals, or the block number to try first
+#define ALLOC_NEW_RUN (-2)
+#define ALLOC_RESERVE (8)	// Blocks left free ahead of a file that starts a new run
+#define STRIPE_LOW_WATER (32) // A RAID 0 disk with under 1/32 of its blocks free takes no more stripes
+static int *free_data; // Per disk count of free data blocks
+static int block_size = BLOCK_SIZE; // Data block size from the superblock, inode slots stay BLOCK_SIZE
+static int inode_format = INODE_CLASSIC; // Format given to new regular files
+static int inline_data = 0; // New regular files start inline
+static int dir_index = 0; // New directories are hashed
+
+// Per inode, the bottom indirect block of its last block lookup. Readers and
+// writers both fill it, under the entry's own lock
+struct MapCacheEntry
 {
-	Path *ret_path;
-	char *split_val;
+	pthread_mutex_t lock;
+	int valid;
+	long first; // First block the bottom block maps, counted from the indirect block
+	off_t bottom;
+};
 
-	// Allocate the path
-	ret_path = malloc(sizeof(Path));
-	if (ret_path == NULL)
-	{
-		printf("Couldn't allocate path struct\n");
-	}
-	ret_path->size = 0;
+static struct MapCacheEntry *map_cache;
 
-	split_val = strtok(path, "/");
+// Per inode read stream. A reader that picks up where the last read ended is
+// sequential and gets a growing window of blocks ahead of it prefetched
+#define READAHEAD_MIN (128 * 1024)
+#define READAHEAD_MAX (2 * 1024 * 1024)
+struct ReadStream
+{
+	off_t next;	   // Offset a sequential reader asks for next
+	off_t ahead;   // End of what has been prefetched already
+	size_t window; // Bytes kept prefetched ahead of the reader, 0 while reads are random
+};
 
-	while (split_val != NULL)
-	{
+static struct ReadStream *read_streams; // For reads made without an open file
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER; // Guards every ReadStream
 
-		// If size = 0
-		if (ret_path->size == 0)
-		{
-			ret_path->path_components = malloc(sizeof(char *));
-			if (ret_path == NULL)
-			{
-				printf("Couldn't allocate path arr\n");
-				return NULL;
-			}
-		}
+// An open file, what open and create put in fi->fh. It pins the inode: an
+// unlinked file keeps its inode and blocks until its last handle is released
+struct OpenFile
+{
+	int num;
+	struct ReadStream stream; // Readahead of this open file
+	pthread_mutex_t lock;	  // Guards the cached run
+	int run_index;			  // The last run mapped, run_len blocks from run_index on at run_entry
+	int run_len;
+	off_t run_entry;
+};
 
-		// If size > 0
-		else
-		{
-			
-			ret_path->path_components = realloc(ret_path->path_components, sizeof(char *) * (ret_path->size + 1));
-			if (ret_path->path_components == NULL)
-			{
-				printf("Error, realloc of path failed\n");
-				return NULL;
-			}
-		}
+static int *open_counts; // Per inode, handles open on it
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER; // Guards open_counts
 
-		// Allocate entry
-		ret_path->path_components[ret_path->size] = strdup(split_val);
-		if (ret_path->path_components[ret_path->size] == NULL)
-		{
-			printf("Error allocating the paths value\n");
-			return NULL;
-		}
-		(ret_path->size)++;
-		split_val = strtok(NULL, "/");
-	}
-	return ret_path;
-}
+// RAID 0 stripe workers, one thread per disk copies that disk's part of a
+// large read or write while the other disks' workers do theirs
+#define STRIPE_PARALLEL_MIN (64 * 1024) // Smaller requests are copied by the caller
 
-/** getInode
- * Returns the inode at a given index
- **/
-static struct wfs_inode *getInode(int inum, int disk)
+struct CopyJob
 {
-	// Check if its allocated
-	if (checkIBitmap(inum, disk) == 0)
+	int disk;
+	void *dst;
+	const void *src;
+	size_t len;
+};
+
+// The jobs of one request, waited on by the thread that made it
+struct StripeBatch
+{
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int pending;
+};
+
+// A request's jobs, queued on the worker of the disk whose jobs it runs
+struct StripeTask
+{
+	struct CopyJob *jobs;
+	int count;
+	int disk;
+	struct StripeBatch *batch;
+	struct StripeTask *next;
+};
+
+struct StripeWorker
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	struct StripeTask *head;
+	struct StripeTask *tail;
+	int stop;
+};
+
+static struct StripeWorker *stripe_workers; // Per disk, NULL until wfs_init starts them
+
+// Locking for FUSE's multi-threaded loop
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER; // Exclusive for namespace changes, shared otherwise
+static pthread_mutex_t *alloc_locks;							// Per disk, guards the bitmaps and allocation hints
+static pthread_rwlock_t *inode_locks;							// Per inode, guards file data, block map and size
+
+// Which RAID 1 mirror serves each block of a read
+#define READ_PRIMARY	 (0) // Always mirror 0
+#define READ_ROUND_ROBIN (1) // Block index modulo the number of mirrors
+#define READ_STRIPE		 (2) // Each mirror serves one contiguous slice of the request
+static int read_policy = READ_PRIMARY;
+static int verified_reads = 0; // RAID 1v, reads return the majority copy of each block
+static int have_sse42 = 0;
+static uint32_t crc32c_table[256];
+
+// When dirty parts of the images are msync'd
+#define DURABLE_NONE   (0) // Only when unmounting, otherwise left to kernel writeback
+#define DURABLE_FSYNC  (1) // On fsync, flush starts writeback early
+#define DURABLE_ALWAYS (2) // Before every modifying operation returns
+static int durability = DURABLE_FSYNC;
+static long page_size;
+static uint64_t **dirty_pages; // Per disk, a bit per page of the image written since it was last synced
+
+// Bytes start to end of a disk image
+struct DirtyRange
+{
+	int disk;
+	off_t start;
+	off_t end;
+};
+
+struct DirtyList
+{
+	int count;
+	int cap;
+	struct DirtyRange *ranges;
+};
+
+// Image layout hints, mkfs -A 2m puts the data region on a huge page boundary
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+static int data_advice = MADV_SEQUENTIAL; // How the data region is read, metadata is always random
+
+// Kernel attribute and entry caching. Every change to the images is made
+// through this mount, and the kernel drops what it cached for the inodes and
+// names a request changes (the file on write, the file and its parent on
+// mknod, mkdir, unlink and rmdir), so the rest can stay cached well past
+// FUSE's one second default. The low-level backend also tells the kernel
+// itself, see invalAttr and invalEntry
+#define CACHE_TIMEOUT (30.0)
+static double cache_timeout = CACHE_TIMEOUT;
+
+static struct DirtyList *dirty_lists; // Per inode, what was written on its behalf since its last fsync
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER; // Guards dirty_lists
+static _Thread_local int dirty_owner = -1; // Inode whose dirty list this thread's writes go on
+
+// Metadata journal, a redo log in disk 0's journal region. Metadata is
+// changed in a private view of each image and only written to the image
+// once the transaction holding it has committed
+#define JOURNAL_BATCH (64) // Operations grouped into one transaction
+#define JOURNAL_TAGS ((int)((BLOCK_SIZE - sizeof(struct wfs_journal_desc)) / sizeof(struct wfs_journal_tag)))
+static int journal_blocks = 0;					// Size of the journal, 0 when there is none
+static int journal_head;						// Journal block the next transaction goes to
+static unsigned int journal_seq;				// Sequence of the next transaction
+static struct wfs_journal_tag *journal_tags;	// Blocks the running transaction changed
+static int journal_count;
+static int journal_cap;
+static int journal_lost;						// Tags couldn't grow, the running transaction is incomplete
+static int journal_ops;							// Operations in the running transaction
+static int *journal_slots;						// Hash set over journal_tags, index + 1
+static unsigned int journal_slot_mask;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t journal_op_lock; // Shared by operations changing metadata, exclusive to commit
+
+// Mount options, given to wfs as -o name=value next to the FUSE options
+struct WfsOptions
+{
+	char *read_policy; // primary, rr or stripe
+	char *durability;  // none, fsync or always
+	char *data_advice; // normal, sequential or random
+	char *cache_timeout; // Seconds the kernel may cache attributes and lookups
+	int lowlevel;		 // Serve the inode based low-level API instead of paths
+};
+
+static struct WfsOptions options;
+
+static const struct fuse_opt wfs_opts[] = {
+	{"read_policy=%s", offsetof(struct WfsOptions, read_policy), 0},
+	{"durability=%s", offsetof(struct WfsOptions, durability), 0},
+	{"data_advice=%s", offsetof(struct WfsOptions, data_advice), 0},
+	{"cache_timeout=%s", offsetof(struct WfsOptions, cache_timeout), 0},
+	{"lowlevel", offsetof(struct WfsOptions, lowlevel), 1},
+	FUSE_OPT_END
+};
+
+struct PathListNode
+{
+	char *data;
+	struct PathListNode *next;
+};
+
+typedef struct
+{
+	char **path_components;
+	int size;
+} Path;
+
+// Holds block_size / sizeof(off_t) entries, sized for the largest block
+struct IndirectBlock
+{
+	off_t blocks[MAX_BLOCK_SIZE / sizeof(off_t)];
+};
+
+// Dentry cache, direct mapped on (disk, parent inode, name)
+#define DCACHE_SIZE (1024)
+
+struct DentryCacheEntry
+{
+	unsigned int seq; // Seqlock, odd while a writer is updating the entry
+	int valid;
+	int disk;
+	int parent;			 // Inode number of the directory holding the entry
+	char name[MAX_NAME];
+	int num;			 // Inode number of the child, -1 if the name doesn't exist
+};
+
+static struct DentryCacheEntry dcache[DCACHE_SIZE];
+
+// ------------HELPTER FUNCINTS-----------------
+// entry is the encoded values. This returns the block offset;
+static off_t getEntryOffset(off_t entry) {
+	off_t ret_val = entry;
+	entry = entry % block_size;
+	ret_val-= entry;
+	return ret_val;
+}
+
+// returns teh disk for  given entry
+static int getEntryDisk(off_t entry) {
+	int ret_val = entry % block_size;
+	return ret_val;
+}
+
+/** getEntryImageDisk
+ * Returns the disk holding the block an entry refers to. RAID 0 entries carry
+ * their own disk, RAID 1 entries live on whichever mirror is asked for
+ **/
+static int getEntryImageDisk(off_t entry, int disk)
+{
+	if (raid_mode == 0)
 	{
-		printf("Inode isn't allocated\n");
-		return NULL;
+		return getEntryDisk(entry);
 	}
-	return (struct wfs_inode *)((char *)mappings[disk] + superblocks[disk]->i_blocks_ptr + (BLOCK_SIZE * inum));
+	return disk;
 }
-/** findOpenDir
- * Finds an open directory in the parent directory
+
+/** getEntryImageOffset
+ * Returns the offset into its disk image of the block an entry refers to
  **/
-static struct wfs_dentry *findOpenDir1(struct wfs_inode *parent, int disk)
+static off_t getEntryImageOffset(off_t entry, int disk)
 {
-	if ((parent->mode & S_IFDIR) == 0)
-	{ // Check if dir is a dir
-		printf("Not a directory passed as dir at inode %d with mode %d\n", parent->num, parent->mode & S_IFDIR);
-		return NULL;
-	}
-	if (disk >= numdisks)
-	{ // Check if this is a valid disk
-		printf("Not a valid disk\n");
-		return NULL;
+	disk = getEntryImageDisk(entry, disk);
+	if (raid_mode == 0)
+	{
+		entry = getEntryOffset(entry);
 	}
-	struct wfs_dentry *curr_entry;
+	return superblocks[disk]->d_blocks_ptr + entry;
+}
 
-	// Checking for open spot in already allocated blocks
-	for (int i = 0; i < N_BLOCKS; i++)
+/** getEntryPtr
+ * Returns a pointer to the data block an entry refers to
+ **/
+static unsigned char *getEntryPtr(off_t entry, int disk)
+{
+	return mappings[getEntryImageDisk(entry, disk)] + getEntryImageOffset(entry, disk);
+}
+
+/** getDataPtr
+ * getEntryPtr for the contents of a file, which never wait for the journal
+ **/
+static unsigned char *getDataPtr(off_t entry, int disk)
+{
+	return data_mappings[getEntryImageDisk(entry, disk)] + getEntryImageOffset(entry, disk);
+}
+
+// ------------DURABILITY-----------------
+/** addDirtyRange
+ * Adds bytes start to end of a disk image to an inode's dirty list, merged
+ * into a recent range of the same disk when they touch
+ **/
+static void addDirtyRange(int inum, int disk, off_t start, off_t end)
+{
+	struct DirtyList *list = &dirty_lists[inum];
+	struct DirtyRange *range;
+
+	pthread_mutex_lock(&dirty_lock);
+	// Writes go round the mirrors or stripes, so look back one range per disk
+	for (int i = list->count - 1; i >= 0 && i >= list->count - 2 * numdisks; i--)
 	{
-		if (parent->blocks[i] != -1)
+		range = &list->ranges[i];
+		if (range->disk == disk && start <= range->end && end >= range->start)
 		{
-			for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-			{
-				curr_entry = (struct wfs_dentry *)((char *)mappings[disk] + superblocks[disk]->d_blocks_ptr + parent->blocks[i] + j);
-				if (curr_entry->num == 0)
-				{
-					return curr_entry;
-				}
-			}
+			range->start = MIN(range->start, start);
+			range->end = MAX(range->end, end);
+			pthread_mutex_unlock(&dirty_lock);
+			return;
 		}
 	}
-
-	// Allocating a new block
-	printf("Allocating new blcok for node %d\n", parent->num);
-	for (int i = 0; i < N_BLOCKS; i++)
+	if (list->count == list->cap)
 	{
-		if (parent->blocks[i] == -1)
-		{
-			parent->blocks[i] = allocateBlock(disk);
-			curr_entry = (struct wfs_dentry*)((char*)mappings[disk] + superblocks[disk]->d_blocks_ptr + parent->blocks[i]);
-			return curr_entry;
+		range = realloc(list->ranges, sizeof(struct DirtyRange) * (list->cap ? list->cap * 2 : 8));
+		if (range == NULL)
+		{ // The disk's dirty pages still cover it
+			pthread_mutex_unlock(&dirty_lock);
+			return;
 		}
+		list->ranges = range;
+		list->cap = list->cap ? list->cap * 2 : 8;
 	}
-	printf("Couldn't find space for dir nor could space be allocated\n");
-	return NULL;
+	list->ranges[list->count].disk = disk;
+	list->ranges[list->count].start = start;
+	list->ranges[list->count].end = end;
+	list->count++;
+	pthread_mutex_unlock(&dirty_lock);
 }
 
-/** findOpenDir
- * Finds an open directory in the parent directory
- **/
-static struct wfs_dentry *findOpenDir0(struct wfs_inode *parent, int disk)
+// Disk whose image holds ptr in either view, or -1, and where in the image it is
+static int imageDisk(const void *ptr, off_t *offset)
 {
-	if ((parent->mode & S_IFDIR) == 0)
-	{ // Check if dir is a dir
-		printf("Not a directory passed as dir at inode %d with mode %d\n", parent->num, parent->mode & S_IFDIR);
-		return NULL;
-	}
-	if (disk >= numdisks)
-	{ // Check if this is a valid disk
-		printf("Not a valid disk\n");
-		return NULL;
-	}
-	struct wfs_dentry *curr_entry;
+	const unsigned char *p = ptr;
 
-	// Checking for open spot in already allocated blocks
-	for (int i = 0; i < N_BLOCKS; i++)
+	for (int disk = 0; disk < numdisks; disk++)
 	{
-		if (parent->blocks[i] != -1)
+		if (p >= mappings[disk] && p < mappings[disk] + disk_size[disk])
 		{
-			for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-			{	
-				disk = getEntryDisk(parent->blocks[i]);
-				curr_entry = (struct wfs_dentry *)((char *)mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(parent->blocks[i]) + j);
-				if (curr_entry->num == 0)
-				{
-					return curr_entry;
-				}
-			}
+			*offset = p - mappings[disk];
+			return disk;
 		}
-	}
-
-	// Allocating a new block
-	printf("Allocating new blcok for node %d\n", parent->num);
-	for (int i = 0; i < N_BLOCKS; i++)
-	{
-		if (parent->blocks[i] == -1)
+		if (p >= data_mappings[disk] && p < data_mappings[disk] + disk_size[disk])
 		{
-			disk = getNextDisk(); // We're going to write to a new disk
-			parent->blocks[i] = allocateBlock(disk); // Allocate a block on the new disk
-			curr_entry = (struct wfs_dentry*)((char*)mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(parent->blocks[i]));
-			printf("Allocated block on disk %d\n", disk);
-			return curr_entry;
+			*offset = p - data_mappings[disk];
+			return disk;
 		}
 	}
-	printf("Couldn't find space for dir nor could space be allocated\n");
-	return NULL;
+	return -1;
 }
 
-/** findOpenDir
- * Finds an open directory in the parent directory
+/** markDirty
+ * Records that len bytes at ptr, somewhere in a disk image, were written.
+ * The pages are flagged in the disk's dirty bitmap and the bytes go on the
+ * dirty list of the inode the calling thread is changing
  **/
-static struct wfs_dentry *findOpenDir(struct wfs_inode *parent, int disk)
+static void markDirty(const void *ptr, size_t len)
 {
-	if(raid_mode == 0) {
-		printf("Find open dir 0\n");
-		return findOpenDir0(parent, disk);
+	off_t start;
+	int disk = imageDisk(ptr, &start);
+	off_t end;
+
+	if (len == 0 || disk == -1)
+	{
+		return;
 	}
-	else if(raid_mode == 1) {
-		printf("Find open dir 1\n");
-		return findOpenDir1(parent, disk);
+	end = start + len;
+	for (long page = start / page_size; page <= (end - 1) / page_size; page++)
+	{
+		__atomic_fetch_or(&dirty_pages[disk][page / 64], (uint64_t)1 << (page % 64), __ATOMIC_RELAXED);
+	}
+	if (dirty_owner != -1)
+	{
+		addDirtyRange(dirty_owner, disk, start, end);
 	}
-	return NULL;
 }
 
-/** linkdir
- * Adds a directory entry from parent to child and another from child to parent
+/** syncRange
+ * msyncs bytes start to end of a disk image, widened to whole pages. Only
+ * the shared view reaches the image, metadata waiting in the private one
+ * gets there through the journal
  **/
-static int linkdir(struct wfs_inode *parent, struct wfs_inode *child, char *child_name, int disk)
+static int syncRange(int disk, off_t start, off_t end)
 {
-	struct wfs_dentry *parent_entry;
-	// struct wfs_dentry* child_entry;
-
-	parent_entry = findOpenDir(parent, disk);
-	// child_entry = findOpenDir(child, disk);
-
-	if (parent_entry == NULL)
+	start -= start % page_size;
+	if (end > disk_size[disk])
 	{
-		printf("Parent or child entry not created\n");
-		return -1;
+		end = disk_size[disk];
+	}
+	TRACE("msync disk %ld [%ld, %ld)", disk, start, end);
+	if (msync(data_mappings[disk] + start, end - start, MS_SYNC) != 0)
+	{
+		LOG_ERROR("msync of disk %d [%ld, %ld) failed\n", disk, (long)start, (long)end);
+		return -EIO;
 	}
-
-	// Enter into parent entry
-	strncpy(parent_entry->name, child_name, MAX_NAME); // Copy child name into parent entry
-	parent_entry->num = child->num;
-	// Enter into child entry
-	// child_entry->name[0] = '.';
-	// child_entry->name[1] = '.';
-	// child_entry->num = parent->num;
-
-	// parent->nlinks++;
-	child->nlinks = 1;
-	parent->size += sizeof(struct wfs_dentry);
-
 	return 0;
 }
-/** deleteDentry
- * removes a directory entry
+
+/** syncDirtyPages
+ * msyncs the dirty pages of a disk within bytes start to end, one call per
+ * run of consecutive dirty pages, and clears them
  **/
-static int deleteDentry(struct wfs_inode *dir, char *entry_name, int disk)
+static int syncDirtyPages(int disk, off_t start, off_t end)
 {
-	printf("deleteDentry(), dir->num: %d entry_name: %s disk: %d\n",dir->num, entry_name, disk );
-	if ((dir->mode & S_IFDIR) == 0)
-	{ // Check if dir is a dir
-		printf("deleteDentry() not a directory %d\n", dir->num);
-		return -1;
-	}
-	if (disk >= numdisks)
-	{ // Check if this is a valid disk
-		printf("Not a valid disk\n");
-		return -1;
-	}
+	long first = start / page_size;
+	long last = (MIN(end, disk_size[disk]) + page_size - 1) / page_size;
+	long run = -1;
+	int ret_val = 0;
+	uint64_t bit;
 
-	struct wfs_dentry *curr_entry;
-	for (int i = 0; i < N_BLOCKS; i++)
-	{ // Iterate over blocks
-		if (dir->blocks[i] != -1)
-		{ // Check if block is used
-			for (uint j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
+	for (long page = first; page <= last; page++)
+	{
+		bit = (uint64_t)1 << (page % 64);
+		if (page < last && (__atomic_fetch_and(&dirty_pages[disk][page / 64], ~bit, __ATOMIC_RELAXED) & bit))
+		{
+			if (run == -1)
 			{
-
-				// Go to data block offset and then add offset into block and then dirents
-				curr_entry = (struct wfs_dentry *)(mappings[disk]
-					 + superblocks[disk]->d_blocks_ptr 
-					+ dir->blocks[i] + j);
-
-				if(curr_entry->num != 0){
-					printf("curr_entry->name: %s\n", curr_entry->name);
-				}
-				if (curr_entry->num != 0 && strcmp(curr_entry->name, entry_name) == 0)
-				{ // If matching entry
-					memset((void *)curr_entry, 0, sizeof(struct wfs_dentry));
-					return 0;
-				}
+				run = page;
+			}
+			continue;
+		}
+		if (run != -1)
+		{
+			if (syncRange(disk, run * page_size, page * page_size) != 0)
+			{
+				ret_val = -EIO;
 			}
+			run = -1;
 		}
 	}
-	printf("No entry found for %s in directory of inode %d\n", entry_name, dir->num);
-	return -1;
+	return ret_val;
 }
 
-/** searchDir
- * Returns the directory entry corresponding to the entry_name in the dir directory
+/** syncInode
+ * Makes what was written on behalf of an inode durable: its dirty ranges,
+ * then the dirty pages of the superblock, bitmaps and inode table of every
+ * disk
  **/
-static struct wfs_dentry *searchDir0(struct wfs_inode *dir, char *entry_name, int disk)
+static int syncInode(int inum)
 {
-	if ((dir->mode & S_IFDIR) == 0)
-	{ // Check if dir is a dir
-		printf("Searching in not a directory %d\n", dir->num);
-		return NULL;
-	}
-	if (disk >= numdisks)
-	{ // Check if this is a valid disk
-		printf("Not a valid disk\n");
-		return NULL;
+	struct DirtyList *list = &dirty_lists[inum];
+	struct DirtyRange *ranges;
+	int count;
+	int ret_val = 0;
+
+	pthread_mutex_lock(&dirty_lock);
+	ranges = list->ranges;
+	count = list->count;
+	list->ranges = NULL;
+	list->count = 0;
+	list->cap = 0;
+	pthread_mutex_unlock(&dirty_lock);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (syncRange(ranges[i].disk, ranges[i].start, ranges[i].end) != 0)
+		{
+			ret_val = -EIO;
+		}
 	}
+	free(ranges);
 
-	struct wfs_dentry *curr_entry;
-
-	for (int i = 0; i < N_BLOCKS; i++)
-	{ // Iterate over blocks
-		if (dir->blocks[i] != -1)
-		{ // Check if block is used
-			for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-			{
-				// Go to data block offset and then add offset into block and then dirents
-				disk = getEntryDisk(dir->blocks[i]);
-				curr_entry = (struct wfs_dentry *)((char *)mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(dir->blocks[i]) + j);
-				if (curr_entry->name != 0 && strcmp(curr_entry->name, entry_name) == 0)
-				{ // If matching entry
-					return curr_entry;
-				}
-			}
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		if (syncDirtyPages(disk, 0, superblocks[disk]->d_blocks_ptr) != 0)
+		{
+			ret_val = -EIO;
 		}
 	}
-	printf("No entry found for %s in directory of inode %d\n", entry_name, dir->num);
-	return NULL;
+	return ret_val;
 }
-/** searchDir
- * Returns the directory entry corresponding to the entry_name in the dir directory
+
+/** startInodeWriteback
+ * Starts writing an inode's dirty ranges back without waiting, so a later
+ * fsync has less left to do. The ranges stay listed for that fsync
  **/
-static struct wfs_dentry *searchDir1(struct wfs_inode *dir, char *entry_name, int disk)
+static void startInodeWriteback(int inum)
 {
-	if ((dir->mode & S_IFDIR) == 0)
-	{ // Check if dir is a dir
-		printf("Searching in not a directory %d\n", dir->num);
-		return NULL;
-	}
-	if (disk >= numdisks)
-	{ // Check if this is a valid disk
-		printf("Not a valid disk\n");
-		return NULL;
+	struct DirtyList *list = &dirty_lists[inum];
+
+	pthread_mutex_lock(&dirty_lock);
+	for (int i = 0; i < list->count; i++)
+	{
+		sync_file_range(disks[list->ranges[i].disk], list->ranges[i].start, list->ranges[i].end - list->ranges[i].start, SYNC_FILE_RANGE_WRITE);
 	}
+	pthread_mutex_unlock(&dirty_lock);
+}
 
-	struct wfs_dentry *curr_entry;
-	for (int i = 0; i < N_BLOCKS; i++)
-	{ // Iterate over blocks
-		if (dir->blocks[i] != -1)
-		{ // Check if block is used
-			for (int j = 0; j < BLOCK_SIZE; j += sizeof(struct wfs_dentry))
-			{
+// msyncs every dirty page of every disk
+static int syncAll()
+{
+	int ret_val = 0;
 
-				// Go to data block offset and then add offset into block and then dirents
-				curr_entry = (struct wfs_dentry *)((char *)mappings[disk] + superblocks[disk]->d_blocks_ptr + dir->blocks[i] + j);
-				if (curr_entry->name != 0 && strcmp(curr_entry->name, entry_name) == 0)
-				{ // If matching entry
-					return curr_entry;
-				}
-			}
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		if (syncDirtyPages(disk, 0, disk_size[disk]) != 0)
+		{
+			ret_val = -EIO;
 		}
 	}
-	printf("No entry found for %s in directory of inode %d\n", entry_name, dir->num);
-	return NULL;
+	return ret_val;
 }
 
+// Whether a superblock is new enough to have field, it always ends before the inode bitmap.
+// A field in the tail padding of an older superblock passes too, so a field read this way
+// must take 0 as its default
+#define SB_HAS(sb, field) ((sb)->i_bitmap_ptr >= (off_t)(offsetof(struct wfs_sb, field) + sizeof((sb)->field)))
 
-/** searchDir
- * Returns the directory entry corresponding to the entry_name in the dir directory
+/** pickMirror
+ * Returns the mirror that serves block index of a read covering the blocks
+ * first to last, according to read_policy
  **/
-static struct wfs_dentry *searchDir(struct wfs_inode *dir, char *entry_name, int disk)
+static int pickMirror(int index, int first, int last)
 {
-	if(raid_mode == 1) {
-		return searchDir1(dir, entry_name, disk);
+	if (raid_mode != 1)
+	{ // RAID 0 entries already name their disk
+		return 0;
 	}
-	else if(raid_mode == 0) {
-		return searchDir0(dir, entry_name, disk);
+	if (read_policy == READ_ROUND_ROBIN)
+	{
+		return index % numdisks;
 	}
-	return NULL;
+	if (read_policy == READ_STRIPE)
+	{
+		return (int)((long)(index - first) * numdisks / (last - first + 1));
+	}
+	return 0;
 }
 
-/** getInode
- * Returns the inode at the end of the path
- **/
-static struct wfs_inode *getInodePath1(Path *path, int disk)
+// ------------RAID 1V CHECKSUMS-----------------
+static void initChecksums()
 {
-	printf("getInodePath path: \n"); 
-	struct wfs_inode *current_inode;
-	char *curr_entry_name;
-	struct wfs_dentry *curr_entry_dirent;
-	current_inode = roots[disk]; // Get root inode 
-	for (int i = 0; i < path->size; i++)
+	// Reflected CRC32C (Castagnoli) table for machines without SSE4.2
+	for (uint32_t i = 0; i < 256; i++)
 	{
-		curr_entry_name = path->path_components[i]; // Get next child name
-		curr_entry_dirent = searchDir(current_inode, curr_entry_name, disk);
-		// Check if entry found
-		if (curr_entry_dirent == NULL)
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
 		{
-			printf("Couldn't find entry %s\n", curr_entry_name);
-			return NULL;
+			crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
 		}
-		current_inode = getInode(curr_entry_dirent->num, disk);
+		crc32c_table[i] = crc;
 	}
-
-	return current_inode;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	have_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
 }
 
-/** getInode
- * Returns the inode at the end of the path
- **/
-static struct wfs_inode *getInodePath(Path *path, int disk)
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32cHw(const unsigned char *data, size_t len)
 {
-	return getInodePath1(path, disk);
-}
+	uint64_t crc = 0xFFFFFFFFu;
+	uint64_t word;
+	size_t i = 0;
 
-// finds entry at the de_offset, then finds offset to next dentry for raid0
-// start_de_offset still == offset from data_blocks_ptr to next direntry
-static struct wfs_dentry *findNextDir0(struct wfs_inode *directory, off_t start_de_offset, off_t *new_de_offset, int disk){
-
-	printf("-------------------findNextDir0()--------------\n");
-	struct wfs_dentry *current_de = (struct wfs_dentry *)(mappings[disk] + superblocks[disk]->d_blocks_ptr + start_de_offset);
-	struct wfs_dentry *next_de;
-
-	int start_block = start_de_offset / BLOCK_SIZE;
-
-	// if its the first time calling findNextDir, then get the first de in the dir
-	if (start_de_offset == 0)
+	for (; i + 8 <= len; i += 8)
+	{
+		memcpy(&word, data + i, 8);
+		crc = _mm_crc32_u64(crc, word);
+	}
+	for (; i < len; i++)
 	{
-		printf("de_offset == 0\n");
-		int found = 0;
+		crc = _mm_crc32_u8((uint32_t)crc, data[i]);
+	}
+	return (uint32_t)crc ^ 0xFFFFFFFFu;
+}
+#endif
 
-		for (int b = 0; b < N_BLOCKS; b++)
-		{
-			if (found != 0)
-			{
-				break;
-			}
-
-			if (directory->blocks[b] == -1)
-			{
-				continue;
-			}
+static uint32_t crc32cSoft(const unsigned char *data, size_t len)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < len; i++)
+	{
+		crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFFu;
+}
 
-			for (int i = 0; i < BLOCK_SIZE; i += sizeof(struct wfs_dentry))
-			{
+static uint32_t blockChecksum(const unsigned char *data, size_t len)
+{
+#if defined(__x86_64__)
+	if (have_sse42)
+	{
+		return crc32cHw(data, len);
+	}
+#endif
+	return crc32cSoft(data, len);
+}
 
-				current_de = (struct wfs_dentry *)(mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(directory->blocks[b]) + i);
-				if (current_de->num != 0)
-				{
-					start_de_offset = getEntryOffset(directory->blocks[b]) + i;
-					found = 1;
-					start_block = b;
-					break;
-				}
-			}
-		}
+/** voteMirror
+ * Returns the mirror holding the majority copy of the block at entry. Blocks
+ * are compared by checksum and only fully compared when the checksums
+ * disagree. Ties go to the mirror mounted first, as the README asks, which
+ * is not always the lower mkfs order
+ **/
+static int voteMirror(off_t entry)
+{
+	uint32_t sums[numdisks];
+	int agree = 1;
+	int best = 0;
+	int best_votes = 0;
+	int votes;
 
-		// IF DIR IS EMPTY
-		if (found == 0)
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		sums[disk] = blockChecksum(getDataPtr(entry, disk), block_size);
+		if (sums[disk] != sums[0])
 		{
-			return NULL;
+			agree = 0;
 		}
 	}
+	if (agree)
+	{
+		return 0;
+	}
 
-	printf("start_block: %d, start_de_offset: %ld \n", start_block, start_de_offset);
-	uint min_offset = start_de_offset;
-	// NOW that we have de_offset and current_de, find the next_de's offset
-	// if de_offset is the end of a block, start searching for the next de at the next block. 
-	// otherwise, search for the next de in the current block. If the de_offset
-	for (int b = start_block; b < N_BLOCKS; b++)
+	LOG_WARN("Mirrors disagree on block %ld, voting\n", entry / block_size);
+	TRACE("mirrors disagree on block %ld", entry / block_size, 0, 0);
+	for (int disk = 0; disk < numdisks; disk++)
 	{
-		printf("b: %d\n", b);
-		if(directory->blocks[b] == -1){
-			continue;
-		}
-		
-		uint o;
-		for (o = ((min_offset % BLOCK_SIZE)); o < BLOCK_SIZE;
-			 o += sizeof(struct wfs_dentry))
+		votes = 0;
+		for (int other = 0; other < numdisks; other++)
 		{
-			printf("we here: o: %d\n", o);
-			next_de = (struct wfs_dentry *)(mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(directory->blocks[b]) +  o);
-
-			if ((next_de->num != 0) && (strcmp(next_de->name, current_de->name) != 0))
+			if (sums[other] == sums[disk] && memcmp(getDataPtr(entry, disk), getDataPtr(entry, other), block_size) == 0)
 			{
-				printf("FOUND NEXT DIR: curr_dir->name: %s next_de->name : %s\n", current_de->name, next_de->name);
-				*new_de_offset = getEntryOffset(directory->blocks[b]) + o;
-				return current_de;
+				votes++;
 			}
 		}
-		
-		// we need to go to the next block
-		min_offset = 0;
+		if (votes > best_votes || (votes == best_votes && mount_index[disk] < mount_index[best]))
+		{
+			best = disk;
+			best_votes = votes;
+		}
 	}
-	
-	// Reached end of directory and no new dentries found
-	printf("end of dir\n");
-	*new_de_offset = 0;
-	return current_de;
+	return best;
 }
 
-// finds the dentry at the de_offset, then finds the offset to the next direntry. Returns
-// eg: let mnt have files a b c.
-// not
-// findNextDir(root, 0, new_offset) = a, new_offset = offset to b.
-// findNextDir(root, 12, new_off) = b, new_off = offset to c.
-// findNextDir(root, c_ffset, new_off) = c, new_off = 0
-// note that blocks[b] == offset from d_blocks_ptr
-static struct wfs_dentry *findNextDir1(struct wfs_inode *directory, off_t de_offset, off_t *new_de_offset)
+// ------------JOURNAL-----------------
+// Block i of disk 0's journal
+static unsigned char *journalBlock(int i)
 {
+	return data_mappings[0] + JOURNAL_PTR + (off_t)BLOCK_SIZE * i;
+}
 
-	printf("-------------------findNextDir()--------------\n");
-	struct wfs_dentry *current_de = (struct wfs_dentry *)(mappings[0] + superblocks[0]->d_blocks_ptr + de_offset);
-	struct wfs_dentry *next_de;
-
-	int start_block = de_offset / BLOCK_SIZE;
+// Slot a block hashes to in journal_slots
+static unsigned int journalSlot(int disk, off_t offset)
+{
+	return ((unsigned int)(offset / BLOCK_SIZE) * 2654435761u ^ disk) & journal_slot_mask;
+}
 
-	// if its the first time calling findNextDir, then get the first de in the dir
-	if (de_offset == 0)
+/** journalGrowLocked
+ * Doubles the room for tags and rehashes them. Every changed block has to be
+ * tagged or it would never leave the private view
+ **/
+static int journalGrowLocked()
+{
+	int cap = journal_cap * 2;
+	unsigned int mask;
+	unsigned int slot;
+	struct wfs_journal_tag *tags;
+	int *slots;
+
+	tags = realloc(journal_tags, sizeof(struct wfs_journal_tag) * cap);
+	if (tags == NULL)
 	{
-		printf("de_offset == 0\n");
-		int found = 0;
-
-		for (int b = 0; b < N_BLOCKS; b++)
+		return -1;
+	}
+	journal_tags = tags;
+	for (mask = 1; mask < 2u * cap; mask <<= 1)
+	{
+	}
+	slots = calloc(mask, sizeof(int));
+	if (slots == NULL)
+	{
+		return -1;
+	}
+	free(journal_slots);
+	journal_slots = slots;
+	journal_slot_mask = mask - 1;
+	journal_cap = cap;
+	for (int i = 0; i < journal_count; i++)
+	{
+		slot = journalSlot(journal_tags[i].disk, journal_tags[i].offset);
+		while (journal_slots[slot] != 0)
 		{
-			if (found != 0)
-			{
-				break;
-			}
-
-			if (directory->blocks[b] == -1)
-			{
-				continue;
-			}
-
-			for (int i = 0; i < BLOCK_SIZE; i += sizeof(struct wfs_dentry))
-			{
-
-				current_de = (struct wfs_dentry *)(mappings[0] + superblocks[0]->d_blocks_ptr + directory->blocks[b] + i);
-
-				if (current_de->num != 0)
-				{
-					de_offset = directory->blocks[b] + i;
-					found = 1;
-					start_block = b;
-					break;
-				}
-			}
+			slot = (slot + 1) & journal_slot_mask;
 		}
+		journal_slots[slot] = i + 1;
+	}
+	return 0;
+}
+
+/** journalAddLocked
+ * Adds the BLOCK_SIZE block at offset of a disk to the running transaction,
+ * once
+ **/
+static void journalAddLocked(int disk, off_t offset)
+{
+	unsigned int slot = journalSlot(disk, offset);
+	struct wfs_journal_tag *tag;
 
-		// IF DIR IS EMPTY
-		if (found == 0)
+	while (journal_slots[slot] != 0)
+	{
+		tag = &journal_tags[journal_slots[slot] - 1];
+		if (tag->disk == disk && tag->offset == offset)
 		{
-			return NULL;
+			return;
 		}
+		slot = (slot + 1) & journal_slot_mask;
 	}
-
-	printf("start_block: %d, de_offset: %ld \n", start_block, de_offset);
-	uint min_offset = de_offset;
-	// NOW that we have de_offset and current_de, find the next_de's offset
-	// if de_offset is the end of a block, start searching for the next de at the next block. 
-	// otherwise, search for the next de in the current block. If the de_offset
-	for (int b = start_block; b < N_BLOCKS; b++)
+	if (journal_count == journal_cap)
 	{
-		printf("b: %d\n", b);
-		if(directory->blocks[b] == -1){
-			continue;
+		if (journalGrowLocked() != 0)
+		{
+			LOG_ERROR("Unable to grow the journal, block %ld of disk %d isn't logged\n", (long)(offset / BLOCK_SIZE), disk);
+			journal_lost = 1;
+			return;
 		}
-		
-		uint o;
-		for (o = ((min_offset % BLOCK_SIZE)); o < BLOCK_SIZE;
-			 o += sizeof(struct wfs_dentry))
+		slot = journalSlot(disk, offset);
+		while (journal_slots[slot] != 0)
 		{
-			printf("we here: o: %d\n", o);
-			next_de = (struct wfs_dentry *)(mappings[0] + superblocks[0]->d_blocks_ptr + directory->blocks[b] +  o);
-
-			if ((next_de->num != 0) && (strcmp(next_de->name, current_de->name) != 0))
-			{
-				printf("FOUND NEXT DIR: curr_dir->name: %s next_de->name : %s\n", current_de->name, next_de->name);
-				*new_de_offset = directory->blocks[b] + o;
-				return current_de;
-			}
+			slot = (slot + 1) & journal_slot_mask;
 		}
-		
-		// we need to go to the next block
-		min_offset = 0;
 	}
-	
-	// Reached end of directory and no new dentries found
-	printf("end of dir\n");
-	*new_de_offset = 0;
-	return current_de;
+	journal_tags[journal_count].disk = disk;
+	journal_tags[journal_count].unused = 0;
+	journal_tags[journal_count].offset = offset;
+	journal_slots[slot] = ++journal_count;
 }
 
-void print_ibitmap(int disk)
+/** markMetaDirty
+ * markDirty for metadata: bitmaps, inodes, directory and mapping blocks.
+ * With a journal the blocks also join the running transaction, which logs
+ * them as they are when it commits and then writes them to the images
+ **/
+static void markMetaDirty(const void *ptr, size_t len)
 {
-	int numinodes = superblocks[disk]->num_inodes;
-	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
-	for (int i = 0; i < numinodes / 8; i++)
+	int disk;
+	off_t start;
+	off_t end;
+
+	markDirty(ptr, len);
+	if (journal_blocks == 0 || len == 0 || (disk = imageDisk(ptr, &start)) == -1)
 	{
-		for (int j = 0; j < 8; j++)
-		{
-			printf("%d", !!((*(inode_bitmap + i) << j) & 0x80));
-		}
-		printf(" ");
+		return;
 	}
-	printf("\n");
-}
-void print_dbitmap(int disk)
-{
-	int numdblocks = superblocks[disk]->num_data_blocks;
-	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
-	for (int i = 0; i < numdblocks / 8; i++)
+	end = start + len;
+	pthread_mutex_lock(&journal_lock);
+	for (off_t offset = start - start % BLOCK_SIZE; offset < end; offset += BLOCK_SIZE)
 	{
-		for (int j = 0; j < 8; j++)
-		{
-			printf("%d", !!((*(data_bitmap + i) << j) & 0x80));
-		}
-		printf(" ");
+		journalAddLocked(disk, offset);
 	}
-	printf("\n");
+	pthread_mutex_unlock(&journal_lock);
 }
 
-void wfs_destroy(void *private_data)
+// Every copy of an inode slot
+static void markInodeDirty(struct wfs_inode *inode)
 {
-	printf("wfs_destroy\n");
+	markMetaDirty(inode, BLOCK_SIZE);
 }
 
-unsigned char *bget(unsigned int bnum, int disk)
+// Starts a new transaction
+static void journalClearLocked()
 {
+	memset(journal_slots, 0, sizeof(int) * (journal_slot_mask + 1));
+	journal_count = 0;
+	journal_lost = 0;
+	journal_ops = 0;
+}
 
-	unsigned char *ret_val;
-	// Checking if bitmap is allocated
-	if (checkDBitmap(bnum, disk) == 0)
+/** journalCheckpointLocked
+ * Makes every disk durable in place, after which no logged transaction is
+ * needed, and empties the journal
+ **/
+static int journalCheckpointLocked()
+{
+	struct wfs_journal_header *header = (struct wfs_journal_header *)journalBlock(0);
+
+	if (syncAll() != 0)
 	{
-		printf("Data Block is not allocated\n");
-		return NULL;
+		return -EIO;
 	}
-
-	// Go to data offset
-	ret_val = mappings[disk] + superblocks[disk]->d_blocks_ptr + (bnum * BLOCK_SIZE);
-	return ret_val;
+	header->sequence = journal_seq;
+	header->start = 1;
+	journal_head = 1;
+	return syncRange(0, JOURNAL_PTR, JOURNAL_PTR + BLOCK_SIZE);
 }
 
-int mapDisks(int argc, char *argv[])
+/** journalWriteHomeLocked
+ * Copies the blocks of the running transaction from the private views into
+ * the images. Nothing in the private views is newer than the images after
+ * that, so the pages they copied on write are dropped and read again from
+ * the images when next touched
+ **/
+static void journalWriteHomeLocked()
 {
-	int i = 1;
+	struct wfs_journal_tag *tag;
 
-	// Reading disk images
-	while (i < argc && argv[i][0] != '-')
+	for (int i = 0; i < journal_count; i++)
 	{
-
-		// read in the disks
-		numdisks++;
-		printf("argv[%d]: %s\n", i, argv[i]);
-		disks = realloc(disks, sizeof(int) * numdisks);
-		int fd = open(argv[i], O_RDWR);
-		if (fd == -1)
+		tag = &journal_tags[i];
+		if (mappings[tag->disk] != data_mappings[tag->disk])
 		{
-			printf("mapDisks(): failed to open file\n");
-			// free(argv[i]);
-			exit(1);
+			memcpy(data_mappings[tag->disk] + tag->offset, mappings[tag->disk] + tag->offset, BLOCK_SIZE);
+			markDirty(data_mappings[tag->disk] + tag->offset, BLOCK_SIZE);
+		}
+	}
+	for (int disk = 0; disk < numdisks && !journal_lost; disk++)
+	{
+		if (mappings[disk] != data_mappings[disk] && madvise(mappings[disk], disk_size[disk], MADV_DONTNEED) != 0)
+		{
+			LOG_WARN("Couldn't drop the private pages of disk %d\n", disk);
 		}
-		disks[i - 1] = fd;
-		i++;
 	}
+}
 
-	// Allocating array to hold the size of the disks
-	disk_size = malloc(sizeof(int) * numdisks);
-	if (disk_size == NULL)
+/** journalCommitLocked
+ * Logs the running transaction: descriptor blocks naming the blocks, their
+ * contents and a commit block, made durable with one msync. Only then are
+ * the blocks written to the images. When the journal is too full the disks
+ * are checkpointed first, and a transaction that could never fit is written
+ * in place instead. Caller holds journal_op_lock exclusively
+ **/
+static int journalCommitLocked()
+{
+	struct wfs_journal_desc *desc;
+	struct wfs_journal_commit *commit;
+	uint32_t *sums;
+	int needed;
+	int b;
+	int n;
+	int ret_val;
+
+	if (journal_count == 0)
 	{
-		printf("Failed to allocate arr for disk sizes\n");
-		exit(1);
+		return 0;
+	}
+	needed = journal_count + (journal_count + JOURNAL_TAGS - 1) / JOURNAL_TAGS + 1;
+	if (journal_lost || needed > journal_blocks - 1)
+	{
+		LOG_INFO("Transaction of %d blocks doesn't fit the journal, writing it in place\n", journal_count);
+		journalWriteHomeLocked();
+		journalClearLocked();
+		return journalCheckpointLocked();
+	}
+	if (journal_head + needed > journal_blocks && journalCheckpointLocked() != 0)
+	{
+		return -EIO;
 	}
+	TRACE("journal commit %ld of %ld blocks at %ld", journal_seq, journal_count, journal_head);
 
-	// Allocate region for beginning ptr in mappings
-	mappings = malloc(sizeof(void *) * numdisks);
-	if (mappings == NULL)
+	sums = malloc(sizeof(uint32_t) * journal_count);
+	if (sums == NULL)
 	{
-		printf("Failed to allocate mapping addrs\n");
-		exit(1);
+		return -ENOMEM;
+	}
+	b = journal_head;
+	for (int t = 0; t < journal_count; t += n)
+	{
+		n = MIN(JOURNAL_TAGS, journal_count - t);
+		desc = (struct wfs_journal_desc *)journalBlock(b++);
+		memset(desc, 0, BLOCK_SIZE);
+		desc->magic = JOURNAL_DESC;
+		desc->sequence = journal_seq;
+		desc->count = n;
+		memcpy(desc->tags, &journal_tags[t], sizeof(struct wfs_journal_tag) * n);
+		for (int i = t; i < t + n; i++)
+		{
+			memcpy(journalBlock(b), mappings[journal_tags[i].disk] + journal_tags[i].offset, BLOCK_SIZE);
+			sums[i] = blockChecksum(journalBlock(b++), BLOCK_SIZE);
+		}
+	}
+	commit = (struct wfs_journal_commit *)journalBlock(b++);
+	memset(commit, 0, BLOCK_SIZE);
+	commit->magic = JOURNAL_COMMIT;
+	commit->sequence = journal_seq;
+	commit->count = journal_count;
+	commit->checksum = blockChecksum((unsigned char *)sums, sizeof(uint32_t) * journal_count);
+	free(sums);
+
+	ret_val = syncRange(0, JOURNAL_PTR + (off_t)BLOCK_SIZE * journal_head, JOURNAL_PTR + (off_t)BLOCK_SIZE * b);
+	if (ret_val != 0)
+	{ // Kept to log again on the next commit
+		return ret_val;
 	}
 
-	// Allocate region in mem for superblock pointers
-	superblocks = malloc(sizeof(struct wfs_sb *) * numdisks);
-	if (superblocks == NULL)
+	// Until the next checkpoint a crash replays the blocks, so they go home unsynced
+	journalWriteHomeLocked();
+	journal_head = b;
+	journal_seq++;
+	journalClearLocked();
+	return 0;
+}
+
+// Whether the running transaction has gathered enough to commit
+static int journalDueLocked()
+{
+	return journal_ops >= JOURNAL_BATCH || journal_lost || journal_count * 2 > journal_blocks;
+}
+
+// Commits the running transaction now, between operations
+static int journalCommit()
+{
+	int ret_val = 0;
+
+	if (journal_blocks == 0)
 	{
-		printf("Failed to allocate superblocks\n");
-		exit(1);
+		return 0;
 	}
+	pthread_rwlock_wrlock(&journal_op_lock);
+	pthread_mutex_lock(&journal_lock);
+	ret_val = journalCommitLocked();
+	pthread_mutex_unlock(&journal_lock);
+	pthread_rwlock_unlock(&journal_op_lock);
+	return ret_val;
+}
 
-	// Allocate region in mem for root of each image
-	roots = malloc(sizeof(struct wfs_inode *) * numdisks);
-	if (roots == NULL)
+/** journalOpBegin
+ * Called before an operation changes any metadata, after tree_lock and
+ * before any other lock. Transactions only commit between operations, so
+ * none of them holds half of one
+ **/
+static void journalOpBegin()
+{
+	if (journal_blocks > 0)
 	{
-		printf("Unable to allocate roots\n");
-		exit(1);
+		pthread_rwlock_rdlock(&journal_op_lock);
 	}
+}
 
-	// Map every disk into memory
-	struct stat my_stat;
-	int disk_order;
-	struct wfs_sb disk_superblock;
+/** journalOpEnd
+ * Ends an operation begun with journalOpBegin, whether or not it succeeded.
+ * The running transaction commits once JOURNAL_BATCH operations or half the
+ * journal have gathered
+ **/
+static int journalOpEnd()
+{
+	int due;
+	int ret_val = 0;
 
-	for (int k = 0; k < numdisks; k++)
+	if (journal_blocks == 0)
 	{
-		read(disks[k], &disk_superblock, sizeof(struct wfs_sb));
-		disk_order = disk_superblock.disk_order -1; // We start at order 1 so subtract 1
-		fstat(disks[k], &my_stat);																	// Get file information about disk image
-		mappings[disk_order] = mmap(NULL, my_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, disks[k], 0); // Map this image into mem
-		disk_size[disk_order] = my_stat.st_size;
-		// Check if mmap worked
-		if (mappings[disk_order] == MAP_FAILED)
-		{
-			printf("Error, couldn't mmap disk into memory\n");
-			exit(1);
-		}
-
-		// Set superblock and root according to offsets
-		superblocks[disk_order] = (struct wfs_sb *)mappings[disk_order];
-		roots[disk_order] = (struct wfs_inode *)((char *)superblocks[disk_order] + superblocks[disk_order]->i_blocks_ptr);
+		return 0;
+	}
+	pthread_mutex_lock(&journal_lock);
+	journal_ops++;
+	due = journalDueLocked();
+	pthread_mutex_unlock(&journal_lock);
+	pthread_rwlock_unlock(&journal_op_lock);
+	if (!due)
+	{
+		return 0;
 	}
 
-	// Check disk order
-	for(int j =0;j<numdisks;j++) {
-		if(superblocks[j]->total_disks != numdisks) {
-			printf("Discrepancy between total disk count and superblock value\n");
-			exit(-1);
-		}
-		if(superblocks[j]->disk_order != j+1) {
-			printf("Error disks out of order, order %d, expected %d\n", superblocks[j]->disk_order, j+1);
-			//exit(-1);
-		}
+	// Another operation may have committed it in the meantime
+	pthread_rwlock_wrlock(&journal_op_lock);
+	pthread_mutex_lock(&journal_lock);
+	if (journalDueLocked())
+	{
+		ret_val = journalCommitLocked();
 	}
-	raid_mode = superblocks[0]->raid_mode;
-	printf("end mapdisks\n");
-	return i;
+	pthread_mutex_unlock(&journal_lock);
+	pthread_rwlock_unlock(&journal_op_lock);
+	return ret_val;
 }
 
-//----------------------CALLBACL FCNS----------------------
+/** syncOp
+ * Ends a modifying operation that succeeded. Its metadata joins the journal's
+ * group commit. With durability=always what it wrote is made durable before
+ * FUSE is answered, for a write only what it wrote for inum
+ **/
+static int syncOp(int inum)
+{
+	int ret_val = journalOpEnd();
 
+	if (durability != DURABLE_ALWAYS)
+	{
+		return ret_val;
+	}
+	if (journalCommit() != 0)
+	{
+		return -EIO;
+	}
+	return inum == -1 ? syncAll() : syncInode(inum);
+}
 
-static int wfs_mkdir0(const char *path, mode_t mode)
+/** replayJournal
+ * Applies every committed transaction in disk 0's journal to the disks, then
+ * empties the journal. A transaction counts when its descriptors carry the
+ * next sequence number and its commit block's checksum matches. Runs at mount
+ * before anything reads the metadata
+ **/
+static int replayJournal()
 {
-		printf("wfs_mkdir\n");
-		char *malleable_path;
-		Path *p;
-		char *dir_name;
-		struct wfs_inode *parent;
-		struct wfs_inode *child;
+	struct wfs_journal_header *header = (struct wfs_journal_header *)journalBlock(0);
+	struct wfs_journal_desc *desc;
+	struct wfs_journal_commit *commit;
+	struct wfs_journal_tag *tag;
+	uint32_t *sums;
+	int start;
+	int pos;
+	int count;
+	int applied = 0;
+
+	if (header->magic != JOURNAL_HEADER || header->start < 1 || header->start >= journal_blocks)
+	{
+		LOG_ERROR("Journal header is corrupt\n");
+		return -1;
+	}
+	sums = malloc(sizeof(uint32_t) * journal_blocks);
+	if (sums == NULL)
+	{
+		return -1;
+	}
 
-		// Making path modifiable
-		malleable_path = strdup(path);
-		if (malleable_path == NULL)
+	journal_seq = header->sequence;
+	start = header->start;
+	while (1)
+	{
+		// Walk to the commit block, checking descriptors and summing images
+		pos = start;
+		count = 0;
+		while (pos < journal_blocks)
 		{
-			return -1;
+			desc = (struct wfs_journal_desc *)journalBlock(pos);
+			if (desc->magic != JOURNAL_DESC || desc->sequence != journal_seq || desc->count < 1 || desc->count > JOURNAL_TAGS || pos + 1 + desc->count >= journal_blocks)
+			{
+				break;
+			}
+			for (int i = 0; i < desc->count; i++)
+			{
+				sums[count++] = blockChecksum(journalBlock(pos + 1 + i), BLOCK_SIZE);
+			}
+			pos += 1 + desc->count;
 		}
-
-		p = splitPath(malleable_path); // Break apart path
-
-		for (int i = 0; i < p->size; i++)
+		commit = (struct wfs_journal_commit *)journalBlock(MIN(pos, journal_blocks - 1));
+		if (count == 0 || pos >= journal_blocks || commit->magic != JOURNAL_COMMIT || commit->sequence != journal_seq || commit->count != count || commit->checksum != blockChecksum((unsigned char *)sums, sizeof(uint32_t) * count))
 		{
-			printf("Path component [%d]: %s\n", i, p->path_components[i]);
+			break;
 		}
 
-		// Checking if this file already exists
-		if (getInodePath(p, 0) != NULL)
+		// Committed, put every block back where it came from
+		for (pos = start; pos < start + count + (count + JOURNAL_TAGS - 1) / JOURNAL_TAGS; pos += 1 + desc->count)
 		{
-			printf("File already exists\n");
-			return -EEXIST;
+			desc = (struct wfs_journal_desc *)journalBlock(pos);
+			for (int i = 0; i < desc->count; i++)
+			{
+				tag = &desc->tags[i];
+				if (tag->disk < 0 || tag->disk >= numdisks || tag->offset < superblocks[tag->disk]->i_bitmap_ptr || tag->offset + BLOCK_SIZE > disk_size[tag->disk])
+				{
+					LOG_ERROR("Journal transaction %u names a block outside the disks\n", journal_seq);
+					continue;
+				}
+				memcpy(data_mappings[tag->disk] + tag->offset, journalBlock(pos + 1 + i), BLOCK_SIZE);
+			}
+		}
+		applied++;
+		journal_seq++;
+		start = pos + 1;
+	}
+	free(sums);
+
+	// The replayed blocks have to be on disk before the log they came from is emptied
+	if (applied > 0)
+	{
+		LOG_INFO("Replayed %d journal transactions\n", applied);
+		for (int disk = 0; disk < numdisks; disk++)
+		{
+			if (msync(data_mappings[disk], disk_size[disk], MS_SYNC) != 0)
+			{
+				return -1;
+			}
+		}
+	}
+	header->sequence = journal_seq;
+	header->start = 1;
+	journal_head = 1;
+	return msync(data_mappings[0], JOURNAL_PTR + BLOCK_SIZE, MS_SYNC);
+}
+
+/** mostFreeDisk
+ * Returns the RAID 0 disk with the most free data blocks
+ **/
+static int mostFreeDisk()
+{
+	int best = 0;
+	for (int disk = 1; disk < numdisks; disk++)
+	{
+		if (__atomic_load_n(&free_data[disk], __ATOMIC_RELAXED) > __atomic_load_n(&free_data[best], __ATOMIC_RELAXED))
+		{
+			best = disk;
+		}
+	}
+	return best;
+}
+
+/** stripeDisk
+ * Returns the RAID 0 disk for the index'th block of a file or directory, the
+ * index mod the number of disks, so the blocks of every file are spread
+ * evenly. Once that disk runs low its blocks go to the disk with the most
+ * free blocks instead
+ **/
+static int stripeDisk(int index)
+{
+	int disk = index % numdisks;
+	if (__atomic_load_n(&free_data[disk], __ATOMIC_RELAXED) > (int)superblocks[disk]->num_data_blocks / STRIPE_LOW_WATER)
+	{
+		return disk;
+	}
+	return mostFreeDisk();
+}
+static int checkDBitmap(unsigned int inum, int disk)
+{
+	int byte_dist = inum / 8;		 // how many byes away from start inum is
+	unsigned char offset = inum % 8; // We want to start at lower bits
+	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+	unsigned char bit_val;
+
+	data_bitmap += byte_dist; // Go byte_dist bytes over
+	bit_val = *data_bitmap;
+	bit_val &= (1 << offset); // Shift over offset times
+	if (bit_val > 0)
+	{
+		return 1;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+static int checkIBitmap(unsigned int inum, int disk)
+{
+
+	int byte_dist = inum / 8;		 // how many byes away from start inum is
+	unsigned char offset = inum % 8; // We want to start at lower bits
+	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
+	unsigned char bit_val;
+
+	inode_bitmap += byte_dist; // Go byte_dist bytes over
+	bit_val = *inode_bitmap;
+	bit_val &= (1 << offset); // Shift over offset times
+	if (bit_val > 0)
+	{
+		return 1;
+	}
+	else
+	{
+		return 0;
+	}
+}
+
+static int markbitmap_d(unsigned int bnum, int used, int disk)
+{
+
+	int byte_dist = bnum / 8;		 // how many byes away from start bnum is
+	unsigned char offset = bnum % 8; // We want to start at lower bits
+	unsigned char *blocks_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+
+	blocks_bitmap += byte_dist; // Go byte_dist bytes over
+	markMetaDirty(blocks_bitmap, 1);
+	if (((*blocks_bitmap >> offset) & 1) != (used == 1))
+	{ // Keep the free count in step when the bit changes
+		__atomic_add_fetch(&free_data[disk], used == 1 ? -1 : 1, __ATOMIC_RELAXED);
+	}
+	// mark it 0
+	if (used != 1)
+	{
+		unsigned char mask = 1;
+		mask = mask << offset;
+		mask = ~mask;
+		*blocks_bitmap &= mask;
+		return 0;
+	}
+	// mark it one
+	*blocks_bitmap = *blocks_bitmap | used << offset;
+
+	return 0;
+}
+
+static int markbitmap_i(unsigned int inum, int used, int disk)
+{
+
+	int byte_dist = inum / 8;		 // how many bytes away from start inum is
+	unsigned char offset = inum % 8; // We want to start at lower bits
+	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
+
+	inode_bitmap += byte_dist; // Go byte_dist bytes over
+	markMetaDirty(inode_bitmap, 1);
+	if (used != 1)
+	{
+		unsigned char mask = 1;
+		mask = mask << offset;
+		mask = ~mask;
+		*inode_bitmap &= mask;
+		return 0;
+	}
+	*inode_bitmap = *inode_bitmap | (unsigned char)used << offset;
+	return 0;
+}
+
+/** loadBitmapWord
+ * Returns the 64 bits of the bitmap starting at bit word * 64. Bits past
+ * nbits read as used so they are never handed out
+ **/
+static uint64_t loadBitmapWord(unsigned char *bitmap, int word, int nbits)
+{
+	uint64_t val = 0;
+	int first_bit = word * 64;
+	int bytes = (nbits - first_bit + 7) / 8;
+
+	if (bytes > 8)
+	{
+		bytes = 8;
+	}
+	memcpy(&val, bitmap + (first_bit / 8), bytes); // Bitmaps aren't 8 byte aligned
+	val = le64toh(val);							   // Bit 0 is the low bit of the first byte
+	if (nbits - first_bit < 64)
+	{
+		val |= ~(uint64_t)0 << (nbits - first_bit);
+	}
+	return val;
+}
+
+// loadBitmapWord with the bits set in held, when there is one, read as used too
+static uint64_t loadUsedWord(unsigned char *bitmap, unsigned char *held, int word, int nbits)
+{
+	return loadBitmapWord(bitmap, word, nbits) | (held != NULL ? loadBitmapWord(held, word, nbits) : 0);
+}
+
+/** committedDBitmap
+ * Returns a disk's data bitmap as of the last commit, or NULL without a
+ * journal. A block the running transaction freed is still in use if a crash
+ * takes the disk back to that commit, so nothing may be written to it before
+ **/
+static unsigned char *committedDBitmap(int disk)
+{
+	if (mappings[disk] == data_mappings[disk])
+	{
+		return NULL;
+	}
+	return data_mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+}
+
+/** findFreeBit
+ * Scans the bitmap a word at a time starting at hint and wrapping around once.
+ * Returns the first bit clear in it and in held, or -1 if there is none
+ **/
+static int findFreeBit(unsigned char *bitmap, unsigned char *held, int nbits, int hint)
+{
+	int nwords = (nbits + 63) / 64;
+	int start_word;
+	uint64_t free_bits;
+
+	if (nbits <= 0)
+	{
+		return -1;
+	}
+	if (hint < 0 || hint >= nbits)
+	{
+		hint = 0;
+	}
+	start_word = hint / 64;
+
+	// Words from the hint to the end, ignoring bits below the hint in the first one
+	free_bits = ~loadUsedWord(bitmap, held, start_word, nbits) & (~(uint64_t)0 << (hint % 64));
+	for (int w = start_word; w < nwords; w++)
+	{
+		if (w != start_word)
+		{
+			free_bits = ~loadUsedWord(bitmap, held, w, nbits);
+		}
+		if (free_bits != 0)
+		{
+			return w * 64 + __builtin_ctzll(free_bits);
+		}
+	}
+
+	// Wrap around to the words before the hint
+	for (int w = 0; w <= start_word; w++)
+	{
+		free_bits = ~loadUsedWord(bitmap, held, w, nbits);
+		if (free_bits != 0)
+		{
+			return w * 64 + __builtin_ctzll(free_bits);
+		}
+	}
+	return -1; // Return -1 if no open mappings are found
+}
+
+static int findFreeInode(int disk)
+{
+	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
+	return findFreeBit(inode_bitmap, NULL, superblocks[disk]->num_inodes, next_free_inode[disk]);
+}
+
+static int findFreeData(int disk)
+{
+	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+	return findFreeBit(data_bitmap, committedDBitmap(disk), superblocks[disk]->num_data_blocks, next_free_data[disk]);
+}
+
+/** findFreeRun
+ * Scans the bitmap from hint, wrapping around once, for len bits in a row
+ * clear in it and in held. Returns the first of them or -1 if there is no
+ * such run
+ **/
+static int findFreeRun(unsigned char *bitmap, unsigned char *held, int nbits, int hint, int len)
+{
+	int run;
+	int bit;
+	int end;
+
+	if (hint < 0 || hint >= nbits)
+	{
+		hint = 0;
+	}
+	for (int pass = 0; pass < 2; pass++)
+	{
+		bit = pass == 0 ? hint : 0;
+		end = pass == 0 ? nbits : hint;
+		run = 0;
+		while (bit < end)
+		{
+			if (bit % 64 == 0 && loadUsedWord(bitmap, held, bit / 64, nbits) == ~(uint64_t)0)
+			{ // Skip full words
+				run = 0;
+				bit += 64;
+				continue;
+			}
+			if ((bitmap[bit / 8] | (held != NULL ? held[bit / 8] : 0)) & (1 << (bit % 8)))
+			{
+				run = 0;
+			}
+			else if (++run == len)
+			{
+				return bit - len + 1;
+			}
+			bit++;
+		}
+	}
+	return -1;
+}
+
+/** pickDataBit
+ * Chooses the data block an allocation gets, with alloc_locks[disk] held.
+ * ALLOC_NEXT_FIT takes the next free block. File data passes the block it
+ * would continue from as goal, taken when free, or ALLOC_NEW_RUN. Either way
+ * a file that can't continue in place starts a run of ALLOC_RESERVE free
+ * blocks and the next fit hint moves past it, so until the allocator wraps
+ * around the rest of the run is left for that file's next appends
+ **/
+static int pickDataBit(int disk, int goal)
+{
+	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+	unsigned char *held = committedDBitmap(disk);
+	int nbits = superblocks[disk]->num_data_blocks;
+	int bit;
+
+	if (goal >= 0 && goal < nbits && checkDBitmap(goal, disk) == 0 && (held == NULL || !(held[goal / 8] & (1 << (goal % 8)))))
+	{
+		if (goal == next_free_data[disk])
+		{
+			next_free_data[disk]++;
+		}
+		return goal;
+	}
+	if (goal != ALLOC_NEXT_FIT)
+	{
+		bit = findFreeRun(data_bitmap, held, nbits, next_free_data[disk], ALLOC_RESERVE);
+		if (bit != -1)
+		{
+			next_free_data[disk] = bit + ALLOC_RESERVE;
+			return bit;
+		}
+	}
+
+	// Nowhere left for a whole run, any block does
+	bit = findFreeData(disk);
+	if (bit != -1)
+	{
+		next_free_data[disk] = bit + 1; // Next fit, wraps in findFreeBit
+	}
+	return bit;
+}
+
+/** zeroNewBlock
+ * Zeroes a block just allocated at offset of a disk image, in the image for
+ * file data and in the private view for metadata, whichever it will hold
+ **/
+static void zeroNewBlock(int disk, off_t offset)
+{
+	memset(data_mappings[disk] + offset, 0, block_size);
+	markDirty(data_mappings[disk] + offset, block_size);
+	if (mappings[disk] != data_mappings[disk])
+	{
+		memset(mappings[disk] + offset, 0, block_size);
+	}
+}
+
+/** allocateBlockLocked
+ * allocateBlock for callers already holding alloc_locks[disk], goal is as
+ * for pickDataBit
+ **/
+static off_t allocateBlockLocked(int disk, int goal)
+{
+	off_t ret_val;
+	int data_bit;
+	uint64_t start = statStart();
+
+	// Find open spot
+	data_bit = pickDataBit(disk, goal);
+	if (data_bit == -1)
+	{
+		statEnd(STAT_ALLOC, start, 0);
+		return -1;
+	}
+
+	ret_val = (off_t)block_size * data_bit; // Offset is block_size * data_bit
+
+	// Initialize new block to zero
+	zeroNewBlock(disk, superblocks[disk]->d_blocks_ptr + ret_val);
+
+	markbitmap_d(data_bit, 1, disk); // Mark this as allocated
+	TRACE("alloc block %ld on disk %ld goal %ld", data_bit, disk, goal);
+	if(raid_mode == 0) {
+		ret_val +=disk;
+	}
+	statEnd(STAT_ALLOC, start, block_size);
+	return ret_val;					 // Returns first entry within block
+}
+
+/** allocateBlock
+ * Finds an open block on the given disk and then returns its offset
+ **/
+static off_t allocateBlock(int disk)
+{
+	off_t ret_val;
+	pthread_mutex_lock(&alloc_locks[disk]);
+	ret_val = allocateBlockLocked(disk, ALLOC_NEXT_FIT);
+	pthread_mutex_unlock(&alloc_locks[disk]);
+	return ret_val;
+}
+
+/** freeDataBlock
+ * Clears a data block's bit in the given disk's copy of the bitmap. RAID 0
+ * entries carry their own disk. The block keeps its bytes, which a committed
+ * transaction may still point at, until zeroNewBlock clears it on reuse
+ **/
+static void freeDataBlock(off_t entry, int disk)
+{
+	TRACE("free block %ld on disk %ld", getEntryOffset(entry) / block_size, getEntryImageDisk(entry, disk), 0);
+	markbitmap_d(getEntryOffset(entry) / block_size, 0, getEntryImageDisk(entry, disk));
+}
+
+/** allocateMirroredBlock
+ * Allocates a block on disk 0 and claims the same block on every other mirror.
+ * All mirror locks are held so concurrent writers see the mirrors in lockstep
+ **/
+static off_t allocateMirroredBlock(int goal)
+{
+	off_t entry;
+
+	for (int disk = 0; disk < numdisks; disk++)
+	{ // Always in disk order
+		pthread_mutex_lock(&alloc_locks[disk]);
+	}
+
+	entry = allocateBlockLocked(0, goal);
+	if (entry != -1)
+	{
+		// Mirrors share the layout, so the block is at the same offset everywhere
+		for (int disk = 1; disk < numdisks; disk++)
+		{
+			zeroNewBlock(disk, getEntryImageOffset(entry, disk));
+			markbitmap_d(entry / block_size, 1, disk);
+			next_free_data[disk] = next_free_data[0];
+		}
+	}
+
+	for (int disk = numdisks - 1; disk >= 0; disk--)
+	{
+		pthread_mutex_unlock(&alloc_locks[disk]);
+	}
+	return entry;
+}
+
+/** allocateFileBlock
+ * Allocates a block for file mapping. RAID 1 claims it on every mirror,
+ * RAID 0 takes the disk with the most room
+ **/
+static off_t allocateFileBlock()
+{
+	if (raid_mode == 1)
+	{
+		return allocateMirroredBlock(ALLOC_NEXT_FIT);
+	}
+	return allocateBlock(mostFreeDisk());
+}
+
+/** allocateDataBlock
+ * Allocates the index'th block of a file. prev is the file's block that this
+ * one should follow on disk, -1 if there isn't one, and the block after it is
+ * the goal. On RAID 0 that is the block one stripe back, and the goal only
+ * counts when it is on the disk stripeDisk picks
+ **/
+static off_t allocateDataBlock(off_t prev, int index)
+{
+	int disk = raid_mode == 0 ? stripeDisk(index) : 0;
+	int goal = ALLOC_NEW_RUN;
+	off_t entry;
+
+	if (prev != -1 && getEntryImageDisk(prev, 0) == disk)
+	{
+		goal = getEntryOffset(prev) / block_size + 1;
+	}
+
+	if (raid_mode == 1)
+	{
+		return allocateMirroredBlock(goal);
+	}
+	pthread_mutex_lock(&alloc_locks[disk]);
+	entry = allocateBlockLocked(disk, goal);
+	pthread_mutex_unlock(&alloc_locks[disk]);
+	return entry;
+}
+
+// How many logical blocks back the block a new one should follow on disk is
+static int allocStride()
+{
+	return raid_mode == 0 ? numdisks : 1;
+}
+
+// Gives back a block from allocateFileBlock, on every mirror
+static void releaseFileBlock(off_t entry)
+{
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
+	{
+		int image_disk = getEntryImageDisk(entry, disk);
+		pthread_mutex_lock(&alloc_locks[image_disk]);
+		freeDataBlock(entry, disk);
+		pthread_mutex_unlock(&alloc_locks[image_disk]);
+	}
+}
+
+// Copies a mapping block changed on disk 0 to the other RAID 1 mirrors
+static void syncMapBlock(off_t entry)
+{
+	markMetaDirty(getEntryPtr(entry, 0), block_size);
+	if (raid_mode != 1)
+	{
+		return;
+	}
+	for (int disk = 1; disk < numdisks; disk++)
+	{
+		memcpy(getEntryPtr(entry, disk), getEntryPtr(entry, 0), block_size);
+		markMetaDirty(getEntryPtr(entry, disk), block_size);
+	}
+}
+
+// Sets one slot of an indirect block on every copy of it
+static void setMapSlot(off_t entry, int slot, off_t value)
+{
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
+	{
+		((struct IndirectBlock *)getEntryPtr(entry, disk))->blocks[slot] = value;
+		markMetaDirty(&((struct IndirectBlock *)getEntryPtr(entry, disk))->blocks[slot], sizeof(off_t));
+	}
+}
+
+/** allocateIndirectBlock
+ * Allocates a mapping block with every slot unmapped
+ **/
+static off_t allocateIndirectBlock()
+{
+	off_t entry = allocateFileBlock();
+	struct IndirectBlock *indirect_block;
+
+	if (entry == -1)
+	{
+		return -1;
+	}
+	indirect_block = (struct IndirectBlock *)getEntryPtr(entry, 0);
+	for (int i = 0; i < (int)(block_size / sizeof(off_t)); i++)
+	{
+		indirect_block->blocks[i] = -1;
+	}
+	syncMapBlock(entry);
+	return entry;
+}
+
+// ------------INODE FORMATS-----------------
+// Slack header of an inode slot
+static struct wfs_inode_ext *getInodeExt(struct wfs_inode *file)
+{
+	return (struct wfs_inode_ext *)((char *)file + sizeof(struct wfs_inode));
+}
+
+/** clearInodeSlack
+ * Zeroes the slack after an inode, all but the generation, which outlives
+ * each use of the inode number
+ **/
+static void clearInodeSlack(struct wfs_inode *file)
+{
+	unsigned int generation = getInodeExt(file)->generation;
+
+	memset(getInodeExt(file), 0, BLOCK_SIZE - sizeof(struct wfs_inode));
+	getInodeExt(file)->generation = generation;
+}
+
+// Records kept in the slack after the header
+static struct wfs_extent *getInodeExtents(struct wfs_inode *file)
+{
+	return (struct wfs_extent *)(getInodeExt(file) + 1);
+}
+
+// Inline file data, after the slack header
+static unsigned char *getInlineData(struct wfs_inode *file)
+{
+	return (unsigned char *)(getInodeExt(file) + 1);
+}
+
+#define INLINE_DATA ((int)(BLOCK_SIZE - sizeof(struct wfs_inode) - sizeof(struct wfs_inode_ext)))
+
+#define INODE_EXTENTS ((int)((BLOCK_SIZE - sizeof(struct wfs_inode) - sizeof(struct wfs_inode_ext)) / sizeof(struct wfs_extent)))
+
+// Extents that fit in one leaf block
+static int leafExtents()
+{
+	return (block_size - sizeof(struct wfs_extent_leaf)) / sizeof(struct wfs_extent);
+}
+
+/** extentFind
+ * Binary searches count sorted records for the last one starting at or
+ * before lblk. Returns its index or -1 if every record starts after lblk
+ **/
+static int extentFind(struct wfs_extent *recs, int count, int lblk)
+{
+	int lo = 0;
+	int hi = count - 1;
+	int found = -1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (recs[mid].lblk <= lblk)
+		{
+			found = mid;
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+/** extentLookup
+ * Returns the entry of logical block lblk of an extent file, or -1 for a
+ * hole. len is set to how many blocks from lblk on are contiguous
+ **/
+static off_t extentLookup(struct wfs_inode *file, int lblk, int *len, int disk)
+{
+	struct wfs_inode_ext *ext = getInodeExt(file);
+	struct wfs_extent *recs = getInodeExtents(file);
+	int count = ext->count;
+	int i;
+
+	if (ext->depth == 1 && count > 0)
+	{
+		i = extentFind(recs, count, lblk);
+		struct wfs_extent_leaf *leaf = (struct wfs_extent_leaf *)getEntryPtr(recs[i < 0 ? 0 : i].pblk, disk);
+		recs = leaf->extents;
+		count = leaf->count;
+	}
+
+	i = extentFind(recs, count, lblk);
+	if (i == -1 || lblk >= recs[i].lblk + recs[i].len)
+	{
+		return -1;
+	}
+	*len = recs[i].len - (lblk - recs[i].lblk);
+	return recs[i].pblk + (off_t)(lblk - recs[i].lblk) * block_size;
+}
+
+// Double and triple indirect blocks of an INODE_INDIRECT3 inode, kept after the slack header
+static struct wfs_inode_indirect *getInodeIndirect(struct wfs_inode *file)
+{
+	return (struct wfs_inode_indirect *)(getInodeExt(file) + 1);
+}
+
+/** walkIndirect
+ * Follows a tree of level levels of indirect blocks from root down to the
+ * bottom indirect block, the one whose slots map the index'th block under
+ * root. With alloc, missing indirect blocks are allocated on the way.
+ * Returns the bottom block or -1
+ **/
+static off_t walkIndirect(off_t *root, int level, long index, int alloc, int disk)
+{
+	int ptrs = block_size / sizeof(off_t);
+	long span = 1; // Blocks under one slot of the current indirect block
+	off_t entry;
+	off_t next;
+	int slot;
+
+	if (*root == -1)
+	{
+		if (!alloc)
+		{
+			return -1;
+		}
+		*root = allocateIndirectBlock();
+		if (*root == -1)
+		{
+			return -1;
+		}
+	}
+
+	for (int l = 1; l < level; l++)
+	{
+		span *= ptrs;
+	}
+	entry = *root;
+	for (; level > 1; level--)
+	{
+		slot = index / span;
+		index %= span;
+		span /= ptrs;
+		next = ((struct IndirectBlock *)getEntryPtr(entry, disk))->blocks[slot];
+		if (next == -1)
+		{
+			if (!alloc)
+			{
+				return -1;
+			}
+			next = allocateIndirectBlock();
+			if (next == -1)
+			{
+				return -1;
+			}
+			setMapSlot(entry, slot, next);
+		}
+		entry = next;
+	}
+	return entry;
+}
+
+/** mapIndirect
+ * Returns the entry of the index'th block of a classic or indirect3 file, or
+ * -1 when it is unmapped. Past the direct blocks come the blocks under the
+ * indirect block, then for indirect3 the double and triple indirect trees.
+ * The bottom indirect block of the last lookup is remembered in map_cache so
+ * sequential access doesn't walk the tree again. With alloc missing blocks
+ * are allocated, which needs the inode write lock. len is set to how many
+ * blocks from index on are contiguous within the bottom block
+ **/
+static off_t mapIndirect(struct wfs_inode *file, int index, int alloc, int disk, int *len)
+{
+	int ptrs = block_size / sizeof(off_t);
+	struct wfs_inode_indirect *indirect = getInodeIndirect(file);
+	struct MapCacheEntry *cache = &map_cache[file->num];
+	long rel;
+	long first;
+	int slot;
+	off_t bottom;
+	off_t *slots;
+
+	*len = 1;
+	if (index < IND_BLOCK)
+	{
+		if (file->blocks[index] == -1 && alloc)
+		{
+			file->blocks[index] = allocateDataBlock(index >= allocStride() ? file->blocks[index - allocStride()] : -1, index);
+		}
+		return file->blocks[index];
+	}
+
+	// The trees start on multiples of ptrs, so every bottom block maps ptrs aligned blocks
+	rel = index - IND_BLOCK;
+	first = rel - rel % ptrs;
+	slot = rel % ptrs;
+
+	bottom = -1;
+	if (disk == 0)
+	{
+		pthread_mutex_lock(&cache->lock);
+		if (cache->valid && cache->first == first)
+		{
+			bottom = cache->bottom;
+		}
+		pthread_mutex_unlock(&cache->lock);
+	}
+	if (bottom == -1)
+	{
+		if (rel < ptrs)
+		{
+			bottom = walkIndirect(&file->blocks[IND_BLOCK], 1, rel, alloc, disk);
+		}
+		else if (getInodeExt(file)->format == INODE_INDIRECT3 && (rel -= ptrs) < (long)ptrs * ptrs)
+		{
+			bottom = walkIndirect(&indirect->dind, 2, rel, alloc, disk);
+		}
+		else if (getInodeExt(file)->format == INODE_INDIRECT3 && (rel -= (long)ptrs * ptrs) < (long)ptrs * ptrs * ptrs)
+		{
+			bottom = walkIndirect(&indirect->tind, 3, rel, alloc, disk);
+		}
+		else
+		{
+			LOG_WARN("Block %d is past the largest file\n", index);
+			return -1;
+		}
+		if (bottom == -1)
+		{
+			return -1;
+		}
+		if (disk == 0)
+		{
+			pthread_mutex_lock(&cache->lock);
+			cache->first = first;
+			cache->bottom = bottom;
+			cache->valid = 1;
+			pthread_mutex_unlock(&cache->lock);
+		}
+	}
+
+	slots = ((struct IndirectBlock *)getEntryPtr(bottom, disk))->blocks;
+	if (slots[slot] == -1)
+	{
+		if (alloc)
+		{ // Follows the block a stride back when it is under the same bottom block
+			setMapSlot(bottom, slot, allocateDataBlock(slot >= allocStride() ? slots[slot - allocStride()] : -1, index));
+		}
+		return slots[slot];
+	}
+	while (slot + *len < ptrs && slots[slot + *len] == slots[slot] + (off_t)*len * block_size)
+	{
+		(*len)++;
+	}
+	return slots[slot];
+}
+
+/** getFileRun
+ * Returns the entry for the index'th data block of a file and sets len to
+ * the number of blocks from index on that are known to be contiguous.
+ * Extent files answer a whole extent with one lookup, the other formats
+ * what is contiguous in one indirect block. Returns -1 for unmapped blocks
+ **/
+static off_t getFileRun(struct wfs_inode *file, int index, int *len, int disk)
+{
+	if (getInodeExt(file)->format == INODE_EXTENT)
+	{
+		return extentLookup(file, index, len, disk);
+	}
+	return mapIndirect(file, index, 0, disk, len);
+}
+
+/** setMappedFormat
+ * Gives a file the block mapped inode format the filesystem was made with
+ **/
+static void setMappedFormat(struct wfs_inode *file)
+{
+	getInodeExt(file)->format = inode_format;
+	if (inode_format == INODE_INDIRECT3)
+	{
+		getInodeIndirect(file)->dind = -1;
+		getInodeIndirect(file)->tind = -1;
+	}
+}
+
+/** initInodeFormat
+ * Sets up a new regular file, inline when the filesystem keeps small files
+ * in the inode
+ **/
+static void initInodeFormat(struct wfs_inode *file)
+{
+	if (inline_data)
+	{
+		getInodeExt(file)->format = INODE_INLINE;
+		return;
+	}
+	setMappedFormat(file);
+}
+
+/** allocateInode
+ * Finds an open inode and then returns its offset from inode ptr
+ **/
+static struct wfs_inode *allocateInode(int disk)
+{
+	int ret_val;
+	int data_bit;
+
+	pthread_mutex_lock(&alloc_locks[disk]);
+	data_bit = findFreeInode(disk);
+	if (data_bit == -1)
+	{
+		pthread_mutex_unlock(&alloc_locks[disk]);
+		return NULL;
+	}
+
+	ret_val = BLOCK_SIZE * data_bit;
+	markbitmap_i(data_bit, 1, disk);
+	next_free_inode[disk] = data_bit + 1;
+	pthread_mutex_unlock(&alloc_locks[disk]);
+
+	// Initialize inode
+	struct wfs_inode *my_inode;
+	my_inode = (struct wfs_inode *)((char *)mappings[disk] + superblocks[disk]->i_blocks_ptr + ret_val);
+	my_inode->mode = 0x777; // RW for UGO
+	my_inode->num = data_bit;
+	my_inode->uid = getuid();
+	my_inode->gid = getgid();
+	my_inode->size = 0; 
+	my_inode->nlinks = 0;
+	my_inode->atim = time(0);
+	my_inode->mtim = time(0);
+	my_inode->ctim = time(0);
+	for (int i = 0; i < N_BLOCKS; i++)
+	{
+		my_inode->blocks[i] = -1;
+	}
+	clearInodeSlack(my_inode); // Classic until told otherwise
+	getInodeExt(my_inode)->generation++;
+	markInodeDirty(my_inode);
+	return my_inode;
+}
+
+/** splitPath
+ * Returns a Path struct which will contain an array of each entry in the path
+ **/
+static Path *splitPath(char *path)
+{
+	Path *ret_path;
+	char *split_val;
+
+	// Allocate the path
+	ret_path = malloc(sizeof(Path));
+	if (ret_path == NULL)
+	{
+		LOG_ERROR("Couldn't allocate path struct\n");
+	}
+	ret_path->size = 0;
+
+	split_val = strtok(path, "/");
+
+	while (split_val != NULL)
+	{
+
+		// If size = 0
+		if (ret_path->size == 0)
+		{
+			ret_path->path_components = malloc(sizeof(char *));
+			if (ret_path == NULL)
+			{
+				LOG_ERROR("Couldn't allocate path arr\n");
+				return NULL;
+			}
+		}
+
+		// If size > 0
+		else
+		{
+			
+			ret_path->path_components = realloc(ret_path->path_components, sizeof(char *) * (ret_path->size + 1));
+			if (ret_path->path_components == NULL)
+			{
+				LOG_ERROR("Error, realloc of path failed\n");
+				return NULL;
+			}
+		}
+
+		// Allocate entry
+		ret_path->path_components[ret_path->size] = strdup(split_val);
+		if (ret_path->path_components[ret_path->size] == NULL)
+		{
+			LOG_ERROR("Error allocating the paths value\n");
+			return NULL;
+		}
+		(ret_path->size)++;
+		split_val = strtok(NULL, "/");
+	}
+	return ret_path;
+}
+
+/** getInode
+ * Returns the inode at a given index
+ **/
+static struct wfs_inode *getInode(int inum, int disk)
+{
+	// Check if its allocated
+	if (checkIBitmap(inum, disk) == 0)
+	{
+		LOG_DEBUG("Inode isn't allocated\n");
+		return NULL;
+	}
+	return (struct wfs_inode *)((char *)mappings[disk] + superblocks[disk]->i_blocks_ptr + (BLOCK_SIZE * inum));
+}
+// ------------DENTRY CACHE-----------------
+// RAID 0 mirrors the directory tree itself, so every disk shares disk 0's entries
+static int dcacheDisk(int disk)
+{
+	if (raid_mode == 0)
+	{
+		return 0;
+	}
+	return disk;
+}
+
+// FNV-1a over the name, seeded with the parent and disk
+static unsigned int dcacheHash(int parent, const char *name, int disk)
+{
+	unsigned int hash = 2166136261u;
+	hash = (hash ^ (unsigned int)parent) * 16777619u;
+	hash = (hash ^ (unsigned int)disk) * 16777619u;
+	for (int i = 0; i < MAX_NAME && name[i] != '\0'; i++)
+	{
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash % DCACHE_SIZE;
+}
+
+/** dcacheLookup
+ * Looks name up in parent without taking any lock. Returns 1 on a hit with
+ * the child in num (-1 for a negative entry) and 0 on a miss
+ **/
+static int dcacheLookup(int parent, const char *name, int disk, int *num)
+{
+	struct DentryCacheEntry *entry;
+	struct DentryCacheEntry copy;
+	unsigned int seq;
+
+	if (strlen(name) >= MAX_NAME)
+	{ // Names that don't fit a dentry are never cached
+		return 0;
+	}
+	disk = dcacheDisk(disk);
+	entry = &dcache[dcacheHash(parent, name, disk)];
+
+	// Copy the entry and retry if a writer got to it in the meantime
+	do
+	{
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+		{ // Being rewritten, just take the slow path
+			return 0;
+		}
+		memcpy(&copy, entry, sizeof(struct DentryCacheEntry));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq);
+
+	if (copy.valid && copy.parent == parent && copy.disk == disk && strncmp(copy.name, name, MAX_NAME) == 0)
+	{
+		*num = copy.num;
+		return 1;
+	}
+	return 0;
+}
+
+// Writers flip the seqlock to odd for the duration of their update
+static void dcacheWriteBegin(struct DentryCacheEntry *entry)
+{
+	unsigned int seq;
+	do
+	{
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) & ~1u;
+	} while (!__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+static void dcacheWriteEnd(struct DentryCacheEntry *entry)
+{
+	__atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+/** dcacheInsert
+ * Records that name in parent maps to num. A num of -1 is a negative entry
+ **/
+static void dcacheInsert(int parent, const char *name, int num, int disk)
+{
+	struct DentryCacheEntry *entry;
+
+	if (strlen(name) >= MAX_NAME)
+	{
+		return;
+	}
+	disk = dcacheDisk(disk);
+	entry = &dcache[dcacheHash(parent, name, disk)]; // Collisions just replace the old entry
+	dcacheWriteBegin(entry);
+	entry->valid = 1;
+	entry->disk = disk;
+	entry->parent = parent;
+	strcpy(entry->name, name);
+	entry->num = num;
+	dcacheWriteEnd(entry);
+}
+
+/** dcachePurgeDir
+ * Drops every entry that lives in the directory dir, used once dir is freed
+ **/
+static void dcachePurgeDir(int dir, int disk)
+{
+	disk = dcacheDisk(disk);
+	for (int i = 0; i < DCACHE_SIZE; i++)
+	{
+		if (dcache[i].valid && dcache[i].parent == dir && dcache[i].disk == disk)
+		{
+			dcacheWriteBegin(&dcache[i]);
+			dcache[i].valid = 0;
+			dcacheWriteEnd(&dcache[i]);
+		}
+	}
+}
+
+// ------------DIRECTORIES-----------------
+/** allocateDirBlock
+ * Allocates the index'th block of a directory. Directory changes are made on
+ * each RAID 1 mirror in turn, RAID 0 stripes directory blocks like file data
+ **/
+static off_t allocateDirBlock(int index, int disk)
+{
+	if (raid_mode == 0)
+	{
+		return allocateBlock(stripeDisk(index));
+	}
+	return allocateBlock(disk);
+}
+
+// Whether blocks[IND_BLOCK] of a directory is an indirect block. Directories
+// from before indirect directory blocks use all N_BLOCKS as direct blocks
+static int dirHasIndirect(struct wfs_inode *dir)
+{
+	return getInodeExt(dir)->format == INODE_HASHED_DIR || getInodeExt(dir)->format == INODE_INDIRECT_DIR;
+}
+
+// Most blocks a directory can have, the direct ones and one indirect block's worth
+static int dirMaxBlocks(struct wfs_inode *dir)
+{
+	return dirHasIndirect(dir) ? IND_BLOCK + block_size / sizeof(off_t) : N_BLOCKS;
+}
+
+/** mapDirBlock
+ * Returns the entry of the index'th block of a directory, or -1 when it is
+ * unmapped. Like a classic file, blocks past the direct ones live under the
+ * indirect block at blocks[IND_BLOCK] when the directory has one. With alloc
+ * missing blocks are allocated
+ **/
+static off_t mapDirBlock(struct wfs_inode *dir, int index, int alloc, int disk)
+{
+	struct IndirectBlock *indirect_block;
+
+	if (index < (dirHasIndirect(dir) ? IND_BLOCK : N_BLOCKS))
+	{
+		if (dir->blocks[index] == -1 && alloc && (dir->blocks[index] = allocateDirBlock(index, disk)) != -1)
+		{
+			markMetaDirty(getEntryPtr(dir->blocks[index], disk), block_size);
+		}
+		return dir->blocks[index];
+	}
+	if (index >= dirMaxBlocks(dir))
+	{
+		LOG_WARN("Directory %d can't have more than %d blocks\n", dir->num, dirMaxBlocks(dir));
+		return -1;
+	}
+
+	if (dir->blocks[IND_BLOCK] == -1)
+	{
+		if (!alloc)
+		{
+			return -1;
+		}
+		dir->blocks[IND_BLOCK] = allocateDirBlock(IND_BLOCK, disk);
+		if (dir->blocks[IND_BLOCK] == -1)
+		{
+			return -1;
+		}
+		indirect_block = (struct IndirectBlock *)getEntryPtr(dir->blocks[IND_BLOCK], disk);
+		for (int i = 0; i < (int)(block_size / sizeof(off_t)); i++)
+		{
+			indirect_block->blocks[i] = -1;
+		}
+		markMetaDirty(indirect_block, block_size);
+	}
+
+	indirect_block = (struct IndirectBlock *)getEntryPtr(dir->blocks[IND_BLOCK], disk);
+	if (indirect_block->blocks[index - IND_BLOCK] == -1 && alloc)
+	{
+		indirect_block->blocks[index - IND_BLOCK] = allocateDirBlock(index, disk);
+		markMetaDirty(&indirect_block->blocks[index - IND_BLOCK], sizeof(off_t));
+		if (indirect_block->blocks[index - IND_BLOCK] != -1)
+		{
+			markMetaDirty(getEntryPtr(indirect_block->blocks[index - IND_BLOCK], disk), block_size);
+		}
+	}
+	return indirect_block->blocks[index - IND_BLOCK];
+}
+
+// Whether a directory's entries are found through a hash index
+static int isHashedDir(struct wfs_inode *dir)
+{
+	return getInodeExt(dir)->format == INODE_HASHED_DIR;
+}
+
+// First directory block holding entries, a hashed directory's index comes before them
+static int dirFirstBlock(struct wfs_inode *dir)
+{
+	return isHashedDir(dir) ? 1 : 0;
+}
+
+// Directory blocks that may be in use
+static int dirBlockCount(struct wfs_inode *dir)
+{
+	if (isHashedDir(dir))
+	{
+		return getInodeExt(dir)->count;
+	}
+	if (!dirHasIndirect(dir))
+	{
+		return N_BLOCKS;
+	}
+	return dir->blocks[IND_BLOCK] == -1 ? IND_BLOCK : dirMaxBlocks(dir);
+}
+
+/** scanDirBlock
+ * Returns the entry called name in one directory block, or the first free
+ * slot when name is NULL
+ **/
+static struct wfs_dentry *scanDirBlock(off_t entry, const char *name, int disk)
+{
+	struct wfs_dentry *dentries;
+
+	if (entry == -1)
+	{
+		return NULL;
+	}
+	dentries = (struct wfs_dentry *)getEntryPtr(entry, disk);
+	for (int j = 0; j < (int)(block_size / sizeof(struct wfs_dentry)); j++)
+	{
+		if (name == NULL ? dentries[j].num == 0 : dentries[j].num != 0 && strncmp(dentries[j].name, name, MAX_NAME) == 0)
+		{
+			return &dentries[j];
+		}
+	}
+	return NULL;
+}
+
+// FNV-1a over a dentry name, what a hashed directory buckets by
+static unsigned int nameHash(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	for (int i = 0; i < MAX_NAME && name[i] != '\0'; i++)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Index of a hashed directory, NULL until its first entry
+static struct wfs_dir_index *getDirIndex(struct wfs_inode *dir, int disk)
+{
+	if (dir->blocks[0] == -1)
+	{
+		return NULL;
+	}
+	return (struct wfs_dir_index *)getEntryPtr(dir->blocks[0], disk);
+}
+
+// Buckets that fit in the index block
+static int dirIndexCap()
+{
+	return (block_size - sizeof(struct wfs_dir_index)) / sizeof(struct wfs_dir_bucket);
+}
+
+/** findBucket
+ * Returns the bucket of a hashed directory whose range holds hash
+ **/
+static int findBucket(struct wfs_dir_index *index, unsigned int hash)
+{
+	int low = 0;
+	int high = index->count - 1;
+	int mid;
+
+	// Last bucket starting at or below hash, bucket 0 starts at 0
+	while (low < high)
+	{
+		mid = (low + high + 1) / 2;
+		if (index->buckets[mid].hash <= hash)
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+/** initDirIndex
+ * Gives a hashed directory its index block and a first bucket covering
+ * every hash
+ **/
+static int initDirIndex(struct wfs_inode *dir, int disk)
+{
+	struct wfs_dir_index *index;
+
+	if (mapDirBlock(dir, 0, 1, disk) == -1 || mapDirBlock(dir, 1, 1, disk) == -1)
+	{
+		LOG_ERROR("Couldn't allocate the index of directory %d\n", dir->num);
+		return -1;
+	}
+	index = getDirIndex(dir, disk);
+	index->count = 1;
+	index->buckets[0].hash = 0;
+	index->buckets[0].block = 1;
+	markMetaDirty(index, block_size);
+	getInodeExt(dir)->count = 2;
+	return 0;
+}
+
+static int compareHash(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+/** splitBucket
+ * Splits the full bucket b of a hashed directory at the median hash of its
+ * entries and of the hash about to be added. The upper half moves to a new
+ * directory block. Fails when the index is full or every hash is the same
+ **/
+static int splitBucket(struct wfs_inode *dir, int b, unsigned int hash, int disk)
+{
+	struct wfs_dir_index *index = getDirIndex(dir, disk);
+	int slots = block_size / sizeof(struct wfs_dentry);
+	unsigned int *hashes;
+	unsigned int split;
+	unsigned int lowest;
+	struct wfs_dentry *old;
+	struct wfs_dentry *moved;
+	off_t entry;
+	int block;
+	int k = 0;
+
+	if (index->count >= dirIndexCap())
+	{
+		LOG_WARN("Index of directory %d is full\n", dir->num);
+		return -1;
+	}
+
+	hashes = malloc((slots + 1) * sizeof(unsigned int));
+	if (hashes == NULL)
+	{
+		return -1;
+	}
+	old = (struct wfs_dentry *)getEntryPtr(mapDirBlock(dir, index->buckets[b].block, 0, disk), disk);
+	for (int j = 0; j < slots; j++)
+	{
+		hashes[j] = nameHash(old[j].name);
+	}
+	hashes[slots] = hash;
+	qsort(hashes, slots + 1, sizeof(unsigned int), compareHash);
+
+	// The lowest hash stays behind, so the split point has to be above it
+	lowest = hashes[0];
+	split = hashes[(slots + 1) / 2];
+	for (int j = (slots + 1) / 2; split == lowest && j <= slots; j++)
+	{
+		split = hashes[j];
+	}
+	free(hashes);
+	if (split == lowest)
+	{
+		LOG_DEBUG("Bucket %d of directory %d only holds one hash\n", b, dir->num);
+		return -1;
+	}
+
+	block = getInodeExt(dir)->count;
+	entry = mapDirBlock(dir, block, 1, disk);
+	if (entry == -1)
+	{
+		return -1;
+	}
+	getInodeExt(dir)->count++;
+
+	moved = (struct wfs_dentry *)getEntryPtr(entry, disk);
+	for (int j = 0; j < slots; j++)
+	{
+		if (nameHash(old[j].name) >= split)
+		{
+			moved[k++] = old[j];
+			memset(&old[j], 0, sizeof(struct wfs_dentry));
+		}
+	}
+
+	memmove(&index->buckets[b + 2], &index->buckets[b + 1], (index->count - b - 1) * sizeof(struct wfs_dir_bucket));
+	index->buckets[b + 1].hash = split;
+	index->buckets[b + 1].block = block;
+	index->count++;
+	markMetaDirty(index, block_size);
+	markMetaDirty(old, block_size);
+	markMetaDirty(moved, block_size);
+	return 0;
+}
+
+/** findOpenDir
+ * Finds a free directory entry in the parent directory for name, allocating
+ * a directory block when needed. A hashed directory only looks in the bucket
+ * for name, splitting it when it is full
+ **/
+static struct wfs_dentry *findOpenDir(struct wfs_inode *parent, const char *name, int disk)
+{
+	struct wfs_dir_index *index;
+	struct wfs_dentry *curr_entry;
+	unsigned int hash;
+	int b;
+
+	if ((parent->mode & S_IFDIR) == 0)
+	{ // Check if dir is a dir
+		LOG_DEBUG("Not a directory passed as dir at inode %d with mode %d\n", parent->num, parent->mode & S_IFDIR);
+		return NULL;
+	}
+	if (disk >= numdisks)
+	{ // Check if this is a valid disk
+		LOG_ERROR("Not a valid disk\n");
+		return NULL;
+	}
+
+	if (isHashedDir(parent))
+	{
+		if (getDirIndex(parent, disk) == NULL && initDirIndex(parent, disk) == -1)
+		{
+			return NULL;
+		}
+		index = getDirIndex(parent, disk);
+		hash = nameHash(name);
+		while (1)
+		{
+			b = findBucket(index, hash);
+			curr_entry = scanDirBlock(mapDirBlock(parent, index->buckets[b].block, 0, disk), NULL, disk);
+			if (curr_entry != NULL)
+			{
+				return curr_entry;
+			}
+			if (splitBucket(parent, b, hash, disk) == -1)
+			{
+				return NULL;
+			}
+		}
+	}
+
+	// Blocks fill up in order, so the first missing block is the next to allocate
+	for (int i = 0; i < dirMaxBlocks(parent); i++)
+	{
+		curr_entry = scanDirBlock(mapDirBlock(parent, i, 1, disk), NULL, disk);
+		if (curr_entry != NULL)
+		{
+			return curr_entry;
+		}
+	}
+	LOG_WARN("Couldn't find space for dir nor could space be allocated\n");
+	return NULL;
+}
+
+/** linkdir
+ * Adds a directory entry from parent to child and another from child to parent
+ **/
+static int linkdir(struct wfs_inode *parent, struct wfs_inode *child, char *child_name, int disk)
+{
+	struct wfs_dentry *parent_entry;
+	// struct wfs_dentry* child_entry;
+	int owner = dirty_owner;
+
+	dirty_owner = parent->num; // Directory blocks go on the parent's dirty list
+	parent_entry = findOpenDir(parent, child_name, disk);
+	// child_entry = findOpenDir(child, disk);
+
+	if (parent_entry == NULL)
+	{
+		LOG_DEBUG("Parent or child entry not created\n");
+		dirty_owner = owner;
+		return -1;
+	}
+
+	// Enter into parent entry
+	strncpy(parent_entry->name, child_name, MAX_NAME); // Copy child name into parent entry
+	parent_entry->num = child->num;
+	dcacheInsert(parent->num, child_name, child->num, disk);
+	TRACE("link inode %ld into directory %ld on disk %ld", child->num, parent->num, disk);
+	// Enter into child entry
+	// child_entry->name[0] = '.';
+	// child_entry->name[1] = '.';
+	// child_entry->num = parent->num;
+
+	// parent->nlinks++;
+	child->nlinks = 1;
+	parent->size += sizeof(struct wfs_dentry);
+	markMetaDirty(parent_entry, sizeof(struct wfs_dentry));
+	markInodeDirty(parent);
+	markInodeDirty(child);
+	dirty_owner = owner;
+
+	return 0;
+}
+
+/** searchDir
+ * Returns the directory entry corresponding to the entry_name in the dir
+ * directory. A hashed directory only reads the bucket entry_name hashes to
+ **/
+static struct wfs_dentry *searchDir1(struct wfs_inode *dir, char *entry_name, int disk)
+{
+	struct wfs_dir_index *index;
+	struct wfs_dentry *curr_entry;
+
+	if ((dir->mode & S_IFDIR) == 0)
+	{ // Check if dir is a dir
+		LOG_DEBUG("Searching in not a directory %d\n", dir->num);
+		return NULL;
+	}
+	if (disk >= numdisks)
+	{ // Check if this is a valid disk
+		LOG_ERROR("Not a valid disk\n");
+		return NULL;
+	}
+
+	if (isHashedDir(dir))
+	{
+		index = getDirIndex(dir, disk);
+		if (index == NULL)
+		{
+			return NULL;
+		}
+		return scanDirBlock(mapDirBlock(dir, index->buckets[findBucket(index, nameHash(entry_name))].block, 0, disk), entry_name, disk);
+	}
+
+	for (int i = 0; i < dirBlockCount(dir); i++)
+	{ // Iterate over blocks
+		curr_entry = scanDirBlock(mapDirBlock(dir, i, 0, disk), entry_name, disk);
+		if (curr_entry != NULL)
+		{
+			return curr_entry;
+		}
+	}
+	LOG_DEBUG("No entry found for %s in directory of inode %d\n", entry_name, dir->num);
+	return NULL;
+}
+
+static struct wfs_dentry *searchDir(struct wfs_inode *dir, char *entry_name, int disk)
+{
+	uint64_t start = statStart();
+	struct wfs_dentry *dentry = searchDir1(dir, entry_name, disk);
+	statEnd(STAT_DIRSCAN, start, 0);
+	return dentry;
+}
+
+/** deleteDentry
+ * removes a directory entry
+ **/
+static int deleteDentry(struct wfs_inode *dir, char *entry_name, int disk)
+{
+	LOG_DEBUG("deleteDentry(), dir->num: %d entry_name: %s disk: %d\n",dir->num, entry_name, disk );
+	struct wfs_dentry *curr_entry = searchDir(dir, entry_name, disk);
+
+	if (curr_entry == NULL)
+	{
+		LOG_DEBUG("No entry found for %s in directory of inode %d\n", entry_name, dir->num);
+		return -1;
+	}
+	TRACE("unlink inode %ld from directory %ld on disk %ld", curr_entry->num, dir->num, disk);
+	memset((void *)curr_entry, 0, sizeof(struct wfs_dentry));
+	dcacheInsert(dir->num, entry_name, -1, disk);
+	dir->size -= sizeof(struct wfs_dentry);
+
+	// Both go on the directory's dirty list
+	int owner = dirty_owner;
+	dirty_owner = dir->num;
+	markMetaDirty(curr_entry, sizeof(struct wfs_dentry));
+	markInodeDirty(dir);
+	dirty_owner = owner;
+	return 0;
+}
+
+/** freeDirBlocks
+ * Frees every block of a directory, its index and indirect block included
+ **/
+static void freeDirBlocks(struct wfs_inode *dir, int disk)
+{
+	off_t entry;
+	int count = dirBlockCount(dir);
+
+	for (int i = 0; i < count + dirHasIndirect(dir); i++)
+	{
+		// The indirect block goes last, once the blocks under it are freed
+		entry = i < count ? mapDirBlock(dir, i, 0, disk) : dir->blocks[IND_BLOCK];
+		if (entry != -1)
+		{
+			pthread_mutex_lock(&alloc_locks[getEntryImageDisk(entry, disk)]);
+			freeDataBlock(entry, disk);
+			pthread_mutex_unlock(&alloc_locks[getEntryImageDisk(entry, disk)]);
+		}
+	}
+}
+
+// Gives a new directory the layout the filesystem was made with
+static void initDirFormat(struct wfs_inode *dir)
+{
+	getInodeExt(dir)->format = dir_index ? INODE_HASHED_DIR : INODE_INDIRECT_DIR;
+}
+
+/** getInode
+ * Returns the inode at the end of the path
+ **/
+/** lookupChild
+ * Returns the inode name refers to in directory dir, NULL when there is none.
+ * Tries the dentry cache before scanning the directory blocks
+ **/
+static struct wfs_inode *lookupChild(struct wfs_inode *dir, const char *name, int disk)
+{
+	struct wfs_dentry *dirent;
+	int cached_num;
+
+	if (dcacheLookup(dir->num, name, disk, &cached_num))
+	{
+		if (cached_num == -1)
+		{
+			LOG_DEBUG("Couldn't find entry %s (cached)\n", name);
+			return NULL;
+		}
+		return getInode(cached_num, disk);
+	}
+
+	TRACE("lookup scans directory %ld on disk %ld", dir->num, disk, 0);
+	dirent = searchDir(dir, (char *)name, disk);
+	// Check if entry found
+	if (dirent == NULL)
+	{
+		LOG_DEBUG("Couldn't find entry %s\n", name);
+		dcacheInsert(dir->num, name, -1, disk);
+		return NULL;
+	}
+	dcacheInsert(dir->num, name, dirent->num, disk);
+	return getInode(dirent->num, disk);
+}
+
+static struct wfs_inode *getInodePath1(Path *path, int disk)
+{
+	LOG_DEBUG("getInodePath path: \n"); 
+	struct wfs_inode *current_inode;
+	current_inode = roots[disk]; // Get root inode 
+	for (int i = 0; i < path->size && current_inode != NULL; i++)
+	{
+		current_inode = lookupChild(current_inode, path->path_components[i], disk);
+	}
+
+	return current_inode;
+}
+
+/** getInode
+ * Returns the inode at the end of the path
+ **/
+static struct wfs_inode *getInodePath(Path *path, int disk)
+{
+	uint64_t start = statStart();
+	struct wfs_inode *inode = getInodePath1(path, disk);
+	statEnd(STAT_PATH, start, 0);
+	return inode;
+}
+
+void print_ibitmap(int disk)
+{
+	int numinodes = superblocks[disk]->num_inodes;
+	unsigned char *inode_bitmap = mappings[disk] + superblocks[disk]->i_bitmap_ptr;
+	for (int i = 0; i < numinodes / 8; i++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			printf("%d", !!((*(inode_bitmap + i) << j) & 0x80));
+		}
+		printf(" ");
+	}
+	printf("\n");
+}
+void print_dbitmap(int disk)
+{
+	int numdblocks = superblocks[disk]->num_data_blocks;
+	unsigned char *data_bitmap = mappings[disk] + superblocks[disk]->d_bitmap_ptr;
+	for (int i = 0; i < numdblocks / 8; i++)
+	{
+		for (int j = 0; j < 8; j++)
+		{
+			printf("%d", !!((*(data_bitmap + i) << j) & 0x80));
+		}
+		printf(" ");
+	}
+	printf("\n");
+}
+
+// ------------STRIPE WORKERS-----------------
+// Makes the copies in jobs that belong to disk
+static void runCopyJobs(struct CopyJob *jobs, int count, int disk)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (jobs[i].disk == disk)
+		{
+			memcpy(jobs[i].dst, jobs[i].src, jobs[i].len);
+		}
+	}
+}
+
+static void *stripeWorker(void *arg)
+{
+	struct StripeWorker *worker = arg;
+	struct StripeTask *task;
+
+	pthread_mutex_lock(&worker->lock);
+	while (1)
+	{
+		while (worker->head == NULL && !worker->stop)
+		{
+			pthread_cond_wait(&worker->wake, &worker->lock);
+		}
+		if (worker->head == NULL)
+		{ // Stopping, and nothing is left queued
+			break;
+		}
+		task = worker->head;
+		worker->head = task->next;
+		if (worker->head == NULL)
+		{
+			worker->tail = NULL;
+		}
+		pthread_mutex_unlock(&worker->lock);
+
+		runCopyJobs(task->jobs, task->count, task->disk);
+		pthread_mutex_lock(&task->batch->lock);
+		if (--task->batch->pending == 0)
+		{
+			pthread_cond_signal(&task->batch->done);
+		}
+		pthread_mutex_unlock(&task->batch->lock);
+
+		pthread_mutex_lock(&worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+	return NULL;
+}
+
+/** startStripeWorkers
+ * Starts a worker per disk for RAID 0 volumes of more than one disk, when
+ * there is more than one CPU to run them. Without them every copy is made by
+ * the calling thread
+ **/
+static void startStripeWorkers()
+{
+	struct StripeWorker *workers;
+	int started;
+
+	if (raid_mode != 0 || numdisks < 2 || sysconf(_SC_NPROCESSORS_ONLN) < 2)
+	{
+		return;
+	}
+	workers = calloc(numdisks, sizeof(struct StripeWorker));
+	if (workers == NULL)
+	{
+		LOG_ERROR("Unable to allocate stripe workers\n");
+		return;
+	}
+	for (started = 0; started < numdisks; started++)
+	{
+		pthread_mutex_init(&workers[started].lock, NULL);
+		pthread_cond_init(&workers[started].wake, NULL);
+		if (pthread_create(&workers[started].thread, NULL, stripeWorker, &workers[started]) != 0)
+		{
+			break;
+		}
+	}
+	if (started < numdisks)
+	{
+		LOG_WARN("Unable to start stripe workers, copies stay serial\n");
+		for (int disk = 0; disk < started; disk++)
+		{
+			pthread_mutex_lock(&workers[disk].lock);
+			workers[disk].stop = 1;
+			pthread_cond_signal(&workers[disk].wake);
+			pthread_mutex_unlock(&workers[disk].lock);
+			pthread_join(workers[disk].thread, NULL);
+		}
+		free(workers);
+		return;
+	}
+	stripe_workers = workers;
+}
+
+// Lets the workers finish what is queued and waits for them to exit
+static void stopStripeWorkers()
+{
+	if (stripe_workers == NULL)
+	{
+		return;
+	}
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		pthread_mutex_lock(&stripe_workers[disk].lock);
+		stripe_workers[disk].stop = 1;
+		pthread_cond_signal(&stripe_workers[disk].wake);
+		pthread_mutex_unlock(&stripe_workers[disk].lock);
+	}
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		pthread_join(stripe_workers[disk].thread, NULL);
+	}
+	free(stripe_workers);
+	stripe_workers = NULL;
+}
+
+/** stripeCopy
+ * Makes every copy in jobs, each disk's jobs on that disk's worker. The
+ * calling thread does the first disk's share itself rather than sit idle,
+ * and returns once all of them are done
+ **/
+static void stripeCopy(struct CopyJob *jobs, int count)
+{
+	int used[numdisks];
+	struct StripeTask tasks[numdisks];
+	struct StripeBatch batch;
+	int own = -1;
+
+	if (stripe_workers == NULL)
+	{
+		for (int disk = 0; disk < numdisks; disk++)
+		{
+			runCopyJobs(jobs, count, disk);
+		}
+		return;
+	}
+
+	memset(used, 0, sizeof(used));
+	for (int i = 0; i < count; i++)
+	{
+		used[jobs[i].disk] = 1;
+	}
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.done, NULL);
+	batch.pending = 0;
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		if (!used[disk])
+		{
+			continue;
+		}
+		if (own == -1)
+		{
+			own = disk;
+			continue;
+		}
+		tasks[disk].jobs = jobs;
+		tasks[disk].count = count;
+		tasks[disk].disk = disk;
+		tasks[disk].batch = &batch;
+		tasks[disk].next = NULL;
+		batch.pending++;
+
+		pthread_mutex_lock(&stripe_workers[disk].lock);
+		if (stripe_workers[disk].tail == NULL)
+		{
+			stripe_workers[disk].head = &tasks[disk];
+		}
+		else
+		{
+			stripe_workers[disk].tail->next = &tasks[disk];
+		}
+		stripe_workers[disk].tail = &tasks[disk];
+		pthread_cond_signal(&stripe_workers[disk].wake);
+		pthread_mutex_unlock(&stripe_workers[disk].lock);
+	}
+
+	if (own != -1)
+	{
+		runCopyJobs(jobs, count, own);
+	}
+	pthread_mutex_lock(&batch.lock);
+	while (batch.pending > 0)
+	{
+		pthread_cond_wait(&batch.done, &batch.lock);
+	}
+	pthread_mutex_unlock(&batch.lock);
+	pthread_mutex_destroy(&batch.lock);
+	pthread_cond_destroy(&batch.done);
+}
+
+// Whether a request of size bytes is worth splitting over the stripe workers
+static int useStripeWorkers(size_t size)
+{
+	return stripe_workers != NULL && size >= STRIPE_PARALLEL_MIN;
+}
+
+void *wfs_init(struct fuse_conn_info *conn)
+{
+	// Threads started before fuse_main wouldn't survive it going to the background
+	startStripeWorkers();
+
+	// Let FUSE splice read replies out of the images and write payloads into them.
+	// A spliced payload can only be drained from its pipe by one thread, so with
+	// stripe workers payloads come in memory and writeFile splits the copy
+	conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+	if (stripe_workers == NULL)
+	{
+		conn->want |= conn->capable & FUSE_CAP_SPLICE_READ;
+	}
+	return NULL;
+}
+
+// Unmounting always leaves the images durable, whatever the durability option
+void wfs_destroy(void *private_data)
+{
+	LOG_INFO("wfs_destroy\n");
+	stopStripeWorkers();
+#if WFS_STATS
+	size_t len;
+	char *stats = renderStats(&len);
+	if (stats != NULL)
+	{
+		fwrite(stats, 1, len, stderr);
+		free(stats);
+	}
+#endif
+	if (journal_blocks > 0)
+	{ // The last transaction commits and goes home, then the journal is left empty
+		pthread_rwlock_wrlock(&journal_op_lock);
+		pthread_mutex_lock(&journal_lock);
+		if (journalCommitLocked() != 0 || journalCheckpointLocked() != 0)
+		{
+			LOG_ERROR("Couldn't sync the disks on unmount\n");
+		}
+		pthread_mutex_unlock(&journal_lock);
+		pthread_rwlock_unlock(&journal_op_lock);
+		return;
+	}
+	if (syncAll() != 0)
+	{
+		LOG_ERROR("Couldn't sync the disks on unmount\n");
+	}
+}
+
+unsigned char *bget(unsigned int bnum, int disk)
+{
+
+	unsigned char *ret_val;
+	// Checking if bitmap is allocated
+	if (checkDBitmap(bnum, disk) == 0)
+	{
+		LOG_DEBUG("Data Block is not allocated\n");
+		return NULL;
+	}
+
+	// Go to data offset
+	ret_val = mappings[disk] + superblocks[disk]->d_blocks_ptr + (bnum * block_size);
+	return ret_val;
+}
+
+/** mapImage
+ * Maps a disk image. When its data region starts on a huge page boundary the
+ * mapping is placed on one too, or the kernel could never use huge pages for it
+ **/
+static void *mapImage(int fd, off_t size, off_t d_blocks_ptr)
+{
+	if (d_blocks_ptr % HUGE_PAGE_SIZE != 0 || size < d_blocks_ptr + HUGE_PAGE_SIZE)
+	{
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	// Reserve enough address space to slide the image up to the boundary
+	off_t reserved = size + HUGE_PAGE_SIZE;
+	char *area = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED)
+	{
+		return MAP_FAILED;
+	}
+	char *start = (char *)(((uintptr_t)area + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	if (mmap(start, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(area, reserved);
+		return MAP_FAILED;
+	}
+
+	// Hand back the reservation on either side of the image
+	char *end = start + (size + page_size - 1) / page_size * page_size;
+	if (start > area)
+	{
+		munmap(area, start - area);
+	}
+	if (area + reserved > end)
+	{
+		munmap(end, area + reserved - end);
+	}
+	return start;
+}
+
+/** adviseDisks
+ * Tells the kernel how each region of the images gets used. The bitmaps and
+ * inode table are small and hit at random, so they are faulted in up front,
+ * the data region follows the data_advice option and may use huge pages
+ **/
+static void adviseDisks()
+{
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		unsigned char *base = mappings[disk];
+		unsigned char *data = data_mappings[disk];
+		off_t meta_end = ((off_t)superblocks[disk]->d_blocks_ptr + page_size - 1) / page_size * page_size;
+		meta_end = MIN(meta_end, disk_size[disk]);
+		if (madvise(base, meta_end, MADV_RANDOM) != 0 || madvise(base, meta_end, MADV_WILLNEED) != 0)
+		{
+			LOG_WARN("adviseDisks(): madvise on the metadata of disk %d failed\n", disk);
+		}
+		if (meta_end == disk_size[disk])
+		{
+			continue;
+		}
+
+		if (madvise(data + meta_end, disk_size[disk] - meta_end, data_advice) != 0)
+		{
+			LOG_WARN("adviseDisks(): madvise on the data of disk %d failed\n", disk);
+		}
+		if (superblocks[disk]->d_blocks_ptr % HUGE_PAGE_SIZE == 0 && ((uintptr_t)data % HUGE_PAGE_SIZE) == 0)
+		{ // Not every filesystem the images live on can back them with huge pages
+			if (madvise(data + meta_end, disk_size[disk] - meta_end, MADV_HUGEPAGE) != 0)
+			{
+				LOG_INFO("adviseDisks(): no huge pages for disk %d\n", disk);
+			}
+		}
+	}
+}
+
+int mapDisks(int argc, char *argv[])
+{
+	int i = 1;
+
+	// Reading disk images
+	while (i < argc && argv[i][0] != '-')
+	{
+
+		// read in the disks
+		numdisks++;
+		LOG_INFO("argv[%d]: %s\n", i, argv[i]);
+		disks = realloc(disks, sizeof(int) * numdisks);
+		int fd = open(argv[i], O_RDWR);
+		if (fd == -1)
+		{
+			LOG_ERROR("mapDisks(): failed to open file\n");
+			// free(argv[i]);
+			exit(1);
+		}
+		disks[i - 1] = fd;
+		i++;
+	}
+
+	// Allocating array to hold the size of the disks
+	disk_size = malloc(sizeof(off_t) * numdisks);
+	if (disk_size == NULL)
+	{
+		LOG_ERROR("Failed to allocate arr for disk sizes\n");
+		exit(1);
+	}
+
+	// Allocate region for beginning ptr in mappings
+	mappings = malloc(sizeof(void *) * numdisks);
+	data_mappings = malloc(sizeof(void *) * numdisks);
+	if (mappings == NULL || data_mappings == NULL)
+	{
+		LOG_ERROR("Failed to allocate mapping addrs\n");
+		exit(1);
+	}
+
+	// Allocate region in mem for superblock pointers
+	superblocks = malloc(sizeof(struct wfs_sb *) * numdisks);
+	if (superblocks == NULL)
+	{
+		LOG_ERROR("Failed to allocate superblocks\n");
+		exit(1);
+	}
+
+	// Allocate region in mem for root of each image
+	roots = malloc(sizeof(struct wfs_inode *) * numdisks);
+	if (roots == NULL)
+	{
+		LOG_ERROR("Unable to allocate roots\n");
+		exit(1);
+	}
+
+	mount_index = malloc(sizeof(int) * numdisks);
+	if (mount_index == NULL)
+	{
+		LOG_ERROR("Unable to allocate mount positions\n");
+		exit(1);
+	}
+
+	// Allocation hints start every search at the front of the bitmaps
+	next_free_inode = calloc(numdisks, sizeof(int));
+	next_free_data = calloc(numdisks, sizeof(int));
+	if (next_free_inode == NULL || next_free_data == NULL)
+	{
+		LOG_ERROR("Unable to allocate bitmap hints\n");
+		exit(1);
+	}
+
+	alloc_locks = malloc(sizeof(pthread_mutex_t) * numdisks);
+	if (alloc_locks == NULL)
+	{
+		LOG_ERROR("Unable to allocate allocator locks\n");
+		exit(1);
+	}
+	for (int k = 0; k < numdisks; k++)
+	{
+		pthread_mutex_init(&alloc_locks[k], NULL);
+	}
+
+	// Map every disk into memory
+	page_size = sysconf(_SC_PAGESIZE);
+	struct stat my_stat;
+	int disk_order;
+	struct wfs_sb disk_superblock;
+	int ordered_fds[numdisks];
+
+	for (int k = 0; k < numdisks; k++)
+	{
+		read(disks[k], &disk_superblock, sizeof(struct wfs_sb));
+		disk_order = disk_superblock.disk_order -1; // We start at order 1 so subtract 1
+		fstat(disks[k], &my_stat);																	// Get file information about disk image
+		data_mappings[disk_order] = mapImage(disks[k], my_stat.st_size, disk_superblock.d_blocks_ptr); // Map this image into mem
+		mappings[disk_order] = data_mappings[disk_order];
+		disk_size[disk_order] = my_stat.st_size;
+		ordered_fds[disk_order] = disks[k];
+		mount_index[disk_order] = k;
+		if (SB_HAS(&disk_superblock, journal_blocks) && disk_superblock.journal_blocks > 0)
+		{ // Metadata is changed in a private view and reaches the image only once committed
+			mappings[disk_order] = mmap(NULL, my_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, disks[k], 0);
+		}
+		// Check if mmap worked
+		if (mappings[disk_order] == MAP_FAILED || data_mappings[disk_order] == MAP_FAILED)
+		{
+			LOG_ERROR("Error, couldn't mmap disk into memory\n");
+			exit(1);
+		}
+
+		// Set superblock and root according to offsets
+		superblocks[disk_order] = (struct wfs_sb *)mappings[disk_order];
+		roots[disk_order] = (struct wfs_inode *)((char *)superblocks[disk_order] + superblocks[disk_order]->i_blocks_ptr);
+	}
+
+	// Keep the descriptors in disk order too, read_buf hands them to FUSE
+	memcpy(disks, ordered_fds, sizeof(int) * numdisks);
+
+	// Check disk order
+	for(int j =0;j<numdisks;j++) {
+		if(superblocks[j]->total_disks != numdisks) {
+			LOG_ERROR("Discrepancy between total disk count and superblock value\n");
+			exit(-1);
+		}
+		if(superblocks[j]->disk_order != j+1) {
+			LOG_ERROR("Error disks out of order, order %d, expected %d\n", superblocks[j]->disk_order, j+1);
+			//exit(-1);
+		}
+	}
+	raid_mode = superblocks[0]->raid_mode;
+
+	// Images made before a field existed have the inode bitmap where it would be, and keep the
+	// defaults. block_size sits in the padding of the original superblock, 0 is the old fixed size
+	if (SB_HAS(superblocks[0], block_size) && superblocks[0]->block_size != 0)
+	{
+		block_size = superblocks[0]->block_size;
+	}
+	if (block_size < BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0)
+	{
+		LOG_ERROR("Invalid block size %d in superblock\n", block_size);
+		exit(1);
+	}
+
+	if (SB_HAS(superblocks[0], inode_format))
+	{
+		inode_format = superblocks[0]->inode_format;
+	}
+	if (SB_HAS(superblocks[0], inline_data))
+	{
+		inline_data = superblocks[0]->inline_data;
+	}
+	if (SB_HAS(superblocks[0], dir_index))
+	{
+		dir_index = superblocks[0]->dir_index;
+	}
+	if (inode_format < INODE_CLASSIC || inode_format > INODE_INDIRECT3)
+	{
+		LOG_ERROR("Invalid inode format %d in superblock\n", inode_format);
+		exit(1);
+	}
+
+	// One lock per inode slot, every disk holds the same inode table
+	inode_locks = malloc(sizeof(pthread_rwlock_t) * superblocks[0]->num_inodes);
+	if (inode_locks == NULL)
+	{
+		LOG_ERROR("Unable to allocate inode locks\n");
+		exit(1);
+	}
+	for (int k = 0; k < (int)superblocks[0]->num_inodes; k++)
+	{
+		pthread_rwlock_init(&inode_locks[k], NULL);
+	}
+	map_cache = calloc(superblocks[0]->num_inodes, sizeof(struct MapCacheEntry));
+	read_streams = calloc(superblocks[0]->num_inodes, sizeof(struct ReadStream));
+	open_counts = calloc(superblocks[0]->num_inodes, sizeof(int));
+	if (map_cache == NULL || read_streams == NULL || open_counts == NULL)
+	{
+		LOG_ERROR("Unable to allocate map cache\n");
+		exit(1);
+	}
+	for (int k = 0; k < (int)superblocks[0]->num_inodes; k++)
+	{
+		pthread_mutex_init(&map_cache[k].lock, NULL);
+	}
+
+	// Nothing is dirty yet
+	dirty_pages = malloc(sizeof(uint64_t *) * numdisks);
+	dirty_lists = calloc(superblocks[0]->num_inodes, sizeof(struct DirtyList));
+	if (dirty_pages == NULL || dirty_lists == NULL)
+	{
+		LOG_ERROR("Unable to allocate dirty tracking\n");
+		exit(1);
+	}
+	for (int k = 0; k < numdisks; k++)
+	{
+		dirty_pages[k] = calloc(disk_size[k] / page_size / 64 + 1, sizeof(uint64_t));
+		if (dirty_pages[k] == NULL)
+		{
+			LOG_ERROR("Unable to allocate dirty tracking\n");
+			exit(1);
+		}
+	}
+	if (raid_mode == RAID_1V)
+	{ // Same layout as RAID 1, only reads differ
+		raid_mode = 1;
+		verified_reads = 1;
+		initChecksums();
+	}
+
+	// Put back whatever the journal committed before the last crash
+	if (SB_HAS(superblocks[0], journal_blocks))
+	{
+		journal_blocks = superblocks[0]->journal_blocks;
+	}
+	if (journal_blocks < 0 || (journal_blocks > 0 && JOURNAL_PTR + (off_t)BLOCK_SIZE * journal_blocks > superblocks[0]->i_bitmap_ptr))
+	{
+		LOG_ERROR("Invalid journal size %d in superblock\n", journal_blocks);
+		exit(1);
+	}
+	if (journal_blocks > 0)
+	{
+		pthread_rwlockattr_t op_attr;
+		initChecksums();
+
+		// A due commit holds off new operations instead of waiting for a gap between them
+		pthread_rwlockattr_init(&op_attr);
+		pthread_rwlockattr_setkind_np(&op_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+		pthread_rwlock_init(&journal_op_lock, &op_attr);
+		pthread_rwlockattr_destroy(&op_attr);
+
+		journal_cap = journal_blocks;
+		journal_tags = malloc(sizeof(struct wfs_journal_tag) * journal_cap);
+		for (journal_slot_mask = 1; journal_slot_mask < 2u * journal_cap; journal_slot_mask <<= 1)
+		{
+		}
+		journal_slots = calloc(journal_slot_mask, sizeof(int));
+		journal_slot_mask--;
+		if (journal_tags == NULL || journal_slots == NULL)
+		{
+			LOG_ERROR("Unable to allocate the journal\n");
+			exit(1);
+		}
+		if (replayJournal() != 0)
+		{
+			LOG_ERROR("Couldn't replay the journal\n");
+			exit(1);
+		}
+	}
+
+	// Free block counts for stripe placement, taken once the bitmaps are final
+	free_data = calloc(numdisks, sizeof(int));
+	if (free_data == NULL)
+	{
+		LOG_ERROR("Unable to allocate free block counts\n");
+		exit(1);
+	}
+	for (int k = 0; k < numdisks; k++)
+	{
+		int nbits = superblocks[k]->num_data_blocks;
+		for (int w = 0; w < (nbits + 63) / 64; w++)
+		{
+			free_data[k] += __builtin_popcountll(~loadBitmapWord(mappings[k] + superblocks[k]->d_bitmap_ptr, w, nbits));
+		}
+	}
+	LOG_INFO("end mapdisks\n");
+	return i;
+}
+
+//----------------------CALLBACL FCNS----------------------
+
+/** mirrorInodeTables
+ * RAID 0 namespace changes are made on disk 0, every disk keeps a copy of
+ * the inode table and inode bitmap. Copies the slots that changed and the
+ * bitmap to the other disks
+ **/
+static void mirrorInodeTables()
+{
+	struct wfs_inode *first;
+	struct wfs_inode *second;
+
+	for (int k = 1; k < numdisks; k++)
+	{
+		first = (struct wfs_inode *)(mappings[0] + superblocks[0]->i_blocks_ptr);
+		second = (struct wfs_inode *)(mappings[k] + superblocks[k]->i_blocks_ptr);
+		for (int i = 0; i < superblocks[0]->num_inodes; i++)
+		{
+			if (memcmp(second, first, BLOCK_SIZE) != 0)
+			{ // Only the slots this operation changed
+				memcpy(second, first, BLOCK_SIZE);
+				markInodeDirty(second);
+			}
+			first = (struct wfs_inode *)((char *)first + BLOCK_SIZE);
+			second = (struct wfs_inode *)((char *)second + BLOCK_SIZE);
+		}
+
+		// Copying inode bitmaps, the superblocks differ in disk_order
+		memcpy(mappings[k] + superblocks[k]->i_bitmap_ptr, mappings[0] + superblocks[0]->i_bitmap_ptr, superblocks[0]->d_bitmap_ptr - superblocks[0]->i_bitmap_ptr);
+		markMetaDirty(mappings[k] + superblocks[k]->i_bitmap_ptr, superblocks[0]->d_bitmap_ptr - superblocks[0]->i_bitmap_ptr);
+	}
+}
+
+
+static int wfs_mkdir0(const char *path, mode_t mode)
+{
+		LOG_DEBUG("wfs_mkdir\n");
+		char *malleable_path;
+		Path *p;
+		char *dir_name;
+		struct wfs_inode *parent;
+		struct wfs_inode *child;
+
+		// Making path modifiable
+		malleable_path = strdup(path);
+		if (malleable_path == NULL)
+		{
+			return -1;
+		}
+
+		p = splitPath(malleable_path); // Break apart path
+
+		for (int i = 0; i < p->size; i++)
+		{
+			LOG_DEBUG("Path component [%d]: %s\n", i, p->path_components[i]);
+		}
+
+		// Checking if this file already exists
+		if (getInodePath(p, 0) != NULL)
+		{
+			LOG_DEBUG("File already exists\n");
+			return -EEXIST;
+		}
+
+		// Strip last element but save name
+		dir_name = p->path_components[p->size - 1];
+		p->size--;
+
+		parent = getInodePath(p, 0);
+		if (parent == NULL)
+		{
+			LOG_DEBUG("Error getting parent\n");
+		}
+
+		child = allocateInode(0);
+		if (child == NULL)
+		{
+			LOG_DEBUG("Error allocating child\n");
+			return -ENOSPC;
+		}
+
+		child->mode |= mode;
+		child->mode |= S_IFDIR;
+		initDirFormat(child);
+
+		if (linkdir(parent, child, dir_name, 0) == -1)
+		{
+			LOG_DEBUG("Linking error\n");
+		}
+
+		mirrorInodeTables();
+	
+	return 0;
+}
+
+static int wfs_mkdir1(const char *path, mode_t mode)
+{
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		LOG_DEBUG("wfs_mkdir\n");
+		char *malleable_path;
+		Path *p;
+		char *dir_name;
+		struct wfs_inode *parent;
+		struct wfs_inode *child;
+
+		// Making path modifiable
+		malleable_path = strdup(path);
+		if (malleable_path == NULL)
+		{
+			return -1;
+		}
+
+		p = splitPath(malleable_path); // Break apart path
+
+		for (int i = 0; i < p->size; i++)
+		{
+			LOG_DEBUG("Path component [%d]: %s\n", i, p->path_components[i]);
+		}
+
+		// Checking if this file already exists
+		if (getInodePath(p, disk) != NULL)
+		{
+			LOG_DEBUG("File already exists\n");
+			return -EEXIST;
+		}
+
+		// Strip last element but save name
+		dir_name = p->path_components[p->size - 1];
+		p->size--;
+
+		parent = getInodePath(p, disk);
+		if (parent == NULL)
+		{
+			LOG_DEBUG("Error getting parent\n");
+		}
+
+		child = allocateInode(disk);
+		if (child == NULL)
+		{
+			LOG_DEBUG("Error allocating child\n");
+			return -ENOSPC;
+		}
+
+		child->mode |= mode;
+		child->mode |= S_IFDIR;
+		initDirFormat(child);
+
+		if (linkdir(parent, child, dir_name, disk) == -1)
+		{
+			LOG_DEBUG("Linking error\n");
+		}
+		
+		free(dir_name);
+		for(int i = 0; i < p->size;i++) {
+			free(p->path_components[i]);
+		}
+		free(p);
+		free(malleable_path);
+	}
+	
+	return 0;
+}
+
+static int wfs_mkdir(const char *path, mode_t mode)
+{
+	int ret_val = -1;
+	uint64_t start = statStart();
+	if (isStatsPath(path))
+	{
+		return -EEXIST;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	if(raid_mode == 0) {
+		ret_val = wfs_mkdir0(path, mode);
+	}
+	else if(raid_mode == 1) {
+		ret_val = wfs_mkdir1(path, mode);
+	}
+	if (ret_val == 0)
+	{
+		ret_val = syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_MKDIR, start, 0);
+	return ret_val;
+}
+// Remove (delete) the given file, symbolic link, hard link, or special node.
+//  Note that if you support hard links, unlink only deletes the data when the last hard link is removed.
+//  See unlink(2) for details.
+//  To delete files, you should free (unallocate) any data blocks associated with the file, free it's inode,
+// and remove the directory entry pointing to the file from the parent inode.
+
+/** freeExtents
+ * Frees every block of count extent records
+ **/
+static void freeExtents(struct wfs_extent *recs, int count, int disk)
+{
+	for (int i = 0; i < count; i++)
+	{
+		for (int b = 0; b < recs[i].len; b++)
+		{
+			freeDataBlock(recs[i].pblk + (off_t)b * block_size, disk);
+		}
+	}
+}
+
+/** freeIndirect
+ * Frees a tree of level levels of indirect blocks and the blocks it maps
+ **/
+static void freeIndirect(off_t root, int level, int disk)
+{
+	struct IndirectBlock *indirect_block;
+
+	if (root == -1)
+	{
+		return;
+	}
+	if (level > 0)
+	{
+		indirect_block = (struct IndirectBlock *)getEntryPtr(root, disk);
+		for (int i = 0; i < (int)(block_size / sizeof(off_t)); i++)
+		{
+			freeIndirect(indirect_block->blocks[i], level - 1, disk);
+		}
+	}
+	freeDataBlock(root, disk);
+}
+
+/** freeFileBlocks
+ * Frees the data and mapping blocks of a file in the given disk's copy
+ **/
+static void freeFileBlocks(struct wfs_inode *file, int disk)
+{
+	struct wfs_inode_ext *ext = getInodeExt(file);
+	struct wfs_extent *recs = getInodeExtents(file);
+
+	// Whatever the format, the inode number may come back as another file
+	pthread_mutex_lock(&map_cache[file->num].lock);
+	map_cache[file->num].valid = 0;
+	pthread_mutex_unlock(&map_cache[file->num].lock);
+	pthread_mutex_lock(&stream_lock);
+	memset(&read_streams[file->num], 0, sizeof(struct ReadStream));
+	pthread_mutex_unlock(&stream_lock);
+
+	if (ext->format == INODE_INLINE)
+	{ // Nothing outside the inode
+		return;
+	}
+	if (ext->format == INODE_EXTENT)
+	{
+		if (ext->depth == 0)
+		{
+			freeExtents(recs, ext->count, disk);
+			return;
+		}
+		for (int i = 0; i < ext->count; i++)
+		{
+			struct wfs_extent_leaf *leaf = (struct wfs_extent_leaf *)getEntryPtr(recs[i].pblk, disk);
+			freeExtents(leaf->extents, leaf->count, disk);
+			freeDataBlock(recs[i].pblk, disk);
+		}
+		return;
+	}
+
+	for (int d = 0; d < IND_BLOCK; d++)
+	{
+		if (file->blocks[d] != -1)
+		{
+			freeDataBlock(file->blocks[d], disk);
+		}
+	}
+	freeIndirect(file->blocks[IND_BLOCK], 1, disk);
+	if (ext->format == INODE_INDIRECT3)
+	{
+		freeIndirect(getInodeIndirect(file)->dind, 2, disk);
+		freeIndirect(getInodeIndirect(file)->tind, 3, disk);
+	}
+}
+
+/** freeInode
+ * Frees a file's blocks and its inode on one disk
+ **/
+static void freeInode(struct wfs_inode *file, int disk)
+{
+	int inode_num = file->num;
+
+	TRACE("free inode %ld on disk %ld", inode_num, disk, 0);
+	freeFileBlocks(file, disk);
+	if (memset((void *)file, 0, sizeof(struct wfs_inode)) != (void *)file)
+	{
+		LOG_ERROR("unlink(): c0ing inode  failed\n");
+	}
+	clearInodeSlack(file);
+	markInodeDirty(file);
+	markbitmap_i(inode_num, 0, disk);
+}
+
+/** freeInodeAll
+ * Frees an unlinked file everywhere it lives, once nothing holds it open
+ **/
+static void freeInodeAll(int num)
+{
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
+	{
+		freeInode(getInode(num, disk), disk);
+	}
+	if (raid_mode == 0)
+	{
+		mirrorInodeTables();
+	}
+}
+
+/** reclaimOrphans
+ * Frees files that were unlinked while open when the last mount went away
+ * before releasing them
+ **/
+static void reclaimOrphans()
+{
+	int reclaimed = 0;
+
+	journalOpBegin();
+	for (int i = 0; i < (int)superblocks[0]->num_inodes; i++)
+	{
+		if (checkIBitmap(i, 0) && getInode(i, 0)->nlinks == 0 && S_ISREG(getInode(i, 0)->mode))
+		{
+			LOG_INFO("reclaiming orphan inode %d\n", i);
+			freeInodeAll(i);
+			reclaimed++;
+		}
+	}
+	if (reclaimed > 0)
+	{
+		syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
+	}
+}
+
+static int unlinkPath(const char *path)
+{
+	LOG_DEBUG("unlink(): path: %s\n",  path);
+	// get the dir and file inode
+	struct wfs_inode *directory;
+	struct wfs_inode *file;
+	char *file_name;
+	int pinned = 0;
+	// RAID 1 unlinks on every mirror, RAID 0 directories and data are shared
+	// so it unlinks once and mirrors the inode tables
+
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
+	{
+		char *pathcpy = strdup(path);
+		if (pathcpy == NULL)
+		{
+			LOG_ERROR("fialed strdup unlink\n");
+			return -1;
+		}
+		Path *splitpath = splitPath(pathcpy);
+		file_name = splitpath->path_components[splitpath->size-1];
+
+		if ((file = getInodePath(splitpath, disk)) == NULL)
+		{
+			LOG_DEBUG("File doesnt exists\n");
+			return -ENOENT;
+		}
+
+		// Decided on the first disk so every mirror agrees. A release
+		// racing this sees nlinks at 0 once we drop the tree lock and frees it
+		if (disk == 0)
+		{
+			pthread_mutex_lock(&open_lock);
+			pinned = open_counts[file->num] > 0;
+			pthread_mutex_unlock(&open_lock);
+		}
+
+		if(splitpath->size > 1){
+			splitpath->size--;
+			directory = getInodePath(splitpath, disk);
+		} else {
+			// IF ROOT
+			directory = roots[disk];
+		}
+
+		if (directory == NULL)
+		{
+			LOG_DEBUG("Error getting directory\n");
+			return -ENOENT;
+		}
+
+		if (deleteDentry(directory, file_name, disk) != 0)
+		{
+			LOG_DEBUG("failed to remove file's dentry from dir\n");
+			return -1;
+		}
+
+		// DELETE FILE IF NLINKS== 0, an open file waits for its last release
+		file->nlinks--;
+		markInodeDirty(file);
+		if (file->nlinks == 0 && !pinned)
+		{
+			LOG_DEBUG("am deleting file\n");
+			freeInode(file, disk);
+		}
+
+		// remove the directory entry to the file
+		
+	
+//		if (deleteDentry(directory, file_name, disk) != 0)
+//		{
+//			printf("failed to remove file's dentry from dir\n");
+//			return -1;
+//		}
+	}
+	if (raid_mode == 0)
+	{
+		mirrorInodeTables();
+	}
+	return 0;
+}
+static int wfs_mknod1(const char *path, mode_t mode, dev_t rdev)
+{
+	for (int disk = 0; disk < numdisks; disk++)
+	{
+		LOG_DEBUG("wfs_mknod\n");
+		char *malleable_path;
+		Path *p;
+		char *dir_name;
+		struct wfs_inode *parent;
+		struct wfs_inode *child;
+
+		// Making path modifiable
+		malleable_path = strdup(path);
+		if (malleable_path == NULL)
+		{
+			LOG_ERROR("couldnt get malleable path\n");
+			return -1;
+		}
+
+		p = splitPath(malleable_path); // Break apart path
+
+		for (int i = 0; i < p->size; i++)
+		{
+			LOG_DEBUG("Path component [%d]: %s\n", i, p->path_components[i]);
+		}
+
+		if (getInodePath(p, disk) != NULL)
+		{
+			LOG_DEBUG("File already exists\n");
+			return -EEXIST;
+		}
+
+		// Strip last element but save name
+		dir_name = p->path_components[p->size - 1];
+		p->size--;
+
+		parent = getInodePath(p, disk);
+		if (parent == NULL)
+		{
+			LOG_DEBUG("Error getting parent\n");
+			return -1;
+		}
+
+		child = allocateInode(disk);
+		if (child == NULL)
+		{
+			LOG_DEBUG("Error allocating child\n");
+			return -ENOSPC;
+		}
+
+		child->mode |= mode;
+		if (S_ISREG(child->mode))
+		{
+			initInodeFormat(child);
+		}
+
+		if (linkdir(parent, child, dir_name, disk) == -1)
+		{
+			LOG_DEBUG("Linking error\n");
+		}
+		for(int i =0; i < p->size;i++) {
+			free(p->path_components[i]);
+		}
+		free(p);
+		free(dir_name);
+	}
+
+	LOG_DEBUG("mknod done\n");
+	return 0;
+}
+
+static int wfs_mknod0(const char *path, mode_t mode, dev_t rdev)
+{
+
+	LOG_DEBUG("wfs_mknod\n");
+	char *malleable_path;
+	Path *p;
+	char *dir_name;
+	struct wfs_inode *parent;
+	struct wfs_inode *child;
+
+	// Making path modifiable
+	malleable_path = strdup(path);
+	if (malleable_path == NULL)
+	{
+		LOG_ERROR("couldnt get malleable path\n");
+		return -1;
+	}
+
+	p = splitPath(malleable_path); // Break apart path
+
+	for (int i = 0; i < p->size; i++)
+	{
+		LOG_DEBUG("Path component [%d]: %s\n", i, p->path_components[i]);
+	}
+
+	if (getInodePath(p, 0) != NULL)
+	{
+		LOG_DEBUG("File already exists\n");
+		return -EEXIST;
+	}
+
+	// Strip last element but save name
+	dir_name = p->path_components[p->size - 1];
+	p->size--;
+
+	parent = getInodePath(p, 0);
+	if (parent == NULL)
+	{
+		LOG_DEBUG("Error getting parent\n");
+		return -1;
+	}
+
+	child = allocateInode(0);
+	if (child == NULL)
+	{
+		LOG_DEBUG("Error allocating child\n");
+		return -ENOSPC;
+	}
+
+	LOG_DEBUG("Child number is %d\n", child->num);
+
+	child->mode |= mode;
+	if (S_ISREG(child->mode))
+	{
+		initInodeFormat(child);
+	}
+
+	if (linkdir(parent, child, dir_name, 0) == -1)
+	{
+		LOG_DEBUG("Linking error\n");
+	}
+
+	mirrorInodeTables();
+
+	LOG_DEBUG("mknod done\n");
+	
+	return 0;
+}
+
+static int wfs_unlink(const char *path)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	if (isStatsPath(path))
+	{
+		return -EACCES;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	ret_val = unlinkPath(path);
+	if (ret_val == 0)
+	{
+		ret_val = syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_UNLINK, start, 0);
+	return ret_val;
+}
+
+// Creates the file at path for mknod and create
+static int mknodPath(const char *path, mode_t mode, dev_t rdev)
+{
+	int ret_val = 0;
+	if (isStatsPath(path))
+	{
+		return -EEXIST;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	if(raid_mode == 0) {
+		ret_val = wfs_mknod0(path, mode, rdev);
+	}
+	else if(raid_mode == 1) {
+		ret_val = wfs_mknod1(path, mode, rdev);
+	}
+	if (ret_val == 0)
+	{
+		ret_val = syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	return ret_val;
+}
+
+static int wfs_mknod(const char *path, mode_t mode, dev_t rdev)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	ret_val = mknodPath(path, mode, rdev);
+	statEnd(STAT_MKNOD, start, 0);
+	return ret_val;
+}
+
+static int removeDir(const char *path)
+{
+
+	// Like unlinkPath, once on RAID 0
+	for(int disk = 0;disk<(raid_mode == 1 ? numdisks : 1);disk++) {
+		
+	
+		LOG_DEBUG("wfs_rmdir()\n");
+
+		char* malleable_path;
+		Path* p;
+		char* dir_name;
+		struct wfs_inode* my_inode;
+		struct wfs_inode* parent;
+		malleable_path = strdup(path);
+		if(malleable_path == NULL) {
+			LOG_ERROR("Cant get path for dir\n");
+			return -1;
+		}
+
+		p = splitPath(malleable_path);
+		if(p == NULL) {
+			LOG_ERROR("Couldn't split path\n");
+			return -1;
+		}
+
+		// Getting the dir to be removed
+		my_inode = getInodePath(p, disk);
+		if(my_inode == NULL) {
+			LOG_DEBUG("Error allocating inode in rmdir\n");
+			return -1;
+		}
+
+		// Allocating child name
+		dir_name = strdup(p->path_components[p->size-1]);
+		if(dir_name == NULL) {
+			LOG_ERROR("Dir name couldnt alloc in rmdir\n");
+			return -1;
+		}
+
+		// Getting the parent
+		p->size--;
+		parent = getInodePath(p, disk);
+		if(parent == NULL) {
+			LOG_DEBUG("Error allocating parent in rmdir\n");
+			return -1;
+		}
+
+		// Check if it is a dir
+		if( (my_inode->mode & S_IFDIR) == 0) {
+			LOG_DEBUG("Error cant rmdir on a non-dir\n");
+			return -1;
+		}
+
+		// Check if its empty
+		if(my_inode->size != 0) {
+			LOG_DEBUG("Error, dir not empty\n");
+			return -1;
+		}
+
+		// Getting the directory entry in the parent
+		struct wfs_dentry* my_dirent;
+		my_dirent = searchDir(parent, dir_name,disk);
+		if(my_dirent == NULL) {
+			LOG_DEBUG("Entry not found in rmdir\n");
+			return -1;
+		}
+
+		// Free the entry in the parent dir
+		memset(my_dirent,0, sizeof(struct wfs_dentry));	
+		dcacheInsert(parent->num, dir_name, -1, disk);
+		dcachePurgeDir(my_inode->num, disk);
+		parent->size-=sizeof(struct wfs_dentry);	
+		markMetaDirty(my_dirent, sizeof(struct wfs_dentry));
+		markInodeDirty(parent);
+		freeDirBlocks(my_inode, disk);
+
+		markbitmap_i(my_inode->num, 0, disk); // Freeing inode
+		unlinkPath(path); // Removing it in parent?
+	}
+	if (raid_mode == 0)
+	{
+		mirrorInodeTables();
+	}
+	return 0;
+}
+
+static int wfs_rmdir(const char *path)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	if (isStatsPath(path))
+	{
+		return -ENOTDIR;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	ret_val = removeDir(path);
+	if (ret_val == 0)
+	{
+		ret_val = syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_RMDIR, start, 0);
+	return ret_val;
+}
+
+// Return one or more directory entries (struct dirent) to the caller
+// It is related to, but not identical to, the readdir(2) and getdents(2) system calls, and the readdir(3) library function. Because of its complexity, it is described separately below. Required for essentially any filesystem,
+//  since it's what makes ls and a whole bunch of other things work.
+// It's also important to note that readdir can return errors in a number of instances; in particular it can return -EBADF if the file handle is invalid, or -ENOENT if you use the path argument and the path doesn't exist.
+
+/** readdirInode
+ * Hands every entry of directory to filler, with the entry's inode number
+ * and file type in the stat
+ **/
+static int readdirInode(struct wfs_inode *directory, void *buf, fuse_fill_dir_t filler)
+{
+	if ((directory->mode & S_IFDIR) == 0)
+	{
+		return -EBADF;
+	}
+
+	char name[MAX_NAME + 1];
+	struct wfs_dentry *dentries;
+	struct wfs_inode *child;
+	struct stat st;
+	off_t entry;
+	for (int i = dirFirstBlock(directory); i < dirBlockCount(directory); i++)
+	{
+		entry = mapDirBlock(directory, i, 0, 0);
+		if (entry == -1)
+		{
+			continue;
+		}
+		dentries = (struct wfs_dentry *)getEntryPtr(entry, 0);
+		for (int j = 0; j < (int)(block_size / sizeof(struct wfs_dentry)); j++)
+		{
+			if (dentries[j].num == 0)
+			{
+				continue;
+			}
+			// Names that fill MAX_NAME aren't terminated
+			strncpy(name, dentries[j].name, MAX_NAME);
+			name[MAX_NAME] = '\0';
+			memset(&st, 0, sizeof(st));
+			st.st_ino = dentries[j].num;
+			child = getInode(dentries[j].num, 0);
+			if (child != NULL)
+			{
+				st.st_mode = child->mode & S_IFMT;
+			}
+			if (filler(buf, name, &st, 0) != 0)
+			{
+				LOG_DEBUG("wfs_readdir(): filler returned nonzero\n");
+				return 0;
+			}
+		}
+	}
+	return 0;
+}
+
+// Every entry is handed to the filler in one call, with offset 0 FUSE keeps the whole listing
+static int readdirPath(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+	LOG_DEBUG("WFS_READDIR()---------\n");
+	char *pathcpy = strdup(path);
+	Path *p = splitPath(pathcpy);
+	if (p == NULL)
+	{
+		LOG_DEBUG("wfs_readdir(): path is null\n");
+		free(pathcpy);
+		return -ENOENT;
+	}
+	// RAID 0 keeps the tree on disk 0, RAID 1 mirrors it
+	struct wfs_inode *directory = getInodePath(p, 0);
+	for (int i = 0; i < p->size; i++)
+	{
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(pathcpy);
+	if (directory == NULL)
+	{
+		return -ENOENT;
+	}
+
+	return readdirInode(directory, buf, filler);
+}
+
+static int wfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
+	int ret_val = -1;
+	uint64_t start = statStart();
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = readdirPath(path, buf, filler);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_READDIR, start, 0);
+	return ret_val;
+}
+/** getHandleRun
+ * getFileRun through the run an open file mapped last. The file is pinned, so
+ * blocks it has mapped never move and the cached run never goes stale, holes
+ * are never cached. handle may be NULL
+ **/
+static off_t getHandleRun(struct wfs_inode *file, struct OpenFile *handle, int index, int *len)
+{
+	off_t entry;
+
+	if (handle == NULL)
+	{
+		return getFileRun(file, index, len, 0);
+	}
+	pthread_mutex_lock(&handle->lock);
+	if (handle->run_len > 0 && index >= handle->run_index && index < handle->run_index + handle->run_len)
+	{
+		*len = handle->run_index + handle->run_len - index;
+		entry = handle->run_entry + (off_t)(index - handle->run_index) * block_size;
+		pthread_mutex_unlock(&handle->lock);
+		return entry;
+	}
+	pthread_mutex_unlock(&handle->lock);
+
+	entry = getFileRun(file, index, len, 0);
+	if (entry != -1)
+	{
+		pthread_mutex_lock(&handle->lock);
+		handle->run_index = index;
+		handle->run_len = *len;
+		handle->run_entry = entry;
+		pthread_mutex_unlock(&handle->lock);
+	}
+	return entry;
+}
+
+/** mapReadRun
+ * Maps the longest run of the file starting at pos, at most max bytes, that
+ * can be served from one place. Not for inline files, which have no blocks. Physically contiguous blocks are coalesced and
+ * on RAID 1 the mirror comes from pickMirror, or voteMirror for RAID 1v. Sets
+ * disk and image_off to where the run lives, image_off is -1 for a hole.
+ * Returns the length of the run
+ **/
+static size_t mapReadRun(struct wfs_inode *file, struct OpenFile *handle, off_t pos, size_t max, int first, int last, int *disk, off_t *image_off)
+{
+	int index = pos / block_size;
+	int in_block = pos % block_size;
+	size_t run = block_size - in_block;
+	int avail;
+	off_t entry = getHandleRun(file, handle, index, &avail);
+	off_t next;
+	int mirror;
+
+	if (entry == -1)
+	{ // Unmapped blocks inside the file read back as zeros
+		*disk = 0;
+		*image_off = -1;
+		return run < max ? run : max;
+	}
+
+	mirror = verified_reads ? voteMirror(entry) : pickMirror(index, first, last);
+	*disk = getEntryImageDisk(entry, mirror);
+	*image_off = getEntryImageOffset(entry, mirror) + in_block;
+
+	// Grow the run while the next block sits right after this one on the same disk
+	while (run < max)
+	{
+		if (avail > 1)
+		{ // Still inside the run the last lookup returned
+			next = entry + block_size;
+			avail--;
+		}
+		else
+		{
+			next = getHandleRun(file, handle, index + 1, &avail);
+		}
+		if (next != entry + block_size ||
+			(verified_reads ? voteMirror(next) : pickMirror(index + 1, first, last)) != mirror)
+		{
+			break;
 		}
+		index++;
+		entry = next;
+		run += block_size;
+	}
+	return run < max ? run : max;
+}
 
-		// Strip last element but save name
-		dir_name = p->path_components[p->size - 1];
-		p->size--;
+// Asks the kernel to start reading bytes start to end of a disk image into the page cache
+static void prefetchImage(int disk, off_t start, off_t end)
+{
+	start -= start % page_size;
+	if (madvise(data_mappings[disk] + start, end - start, MADV_WILLNEED) != 0)
+	{
+		LOG_WARN("prefetchImage(): madvise failed on disk %d\n", disk);
+	}
+}
+
+/** prefetchFile
+ * Prefetches the blocks holding bytes start to end of a file. Each disk's
+ * blocks are gathered into one range while they stay close together, so a
+ * striped or mirrored file costs one madvise per member disk, not per block.
+ * RAID 1v reads every copy, so every mirror is prefetched
+ **/
+static void prefetchFile(struct wfs_inode *file, off_t start, off_t end)
+{
+	int index = start / block_size;
+	int last = (end - 1) / block_size;
+	int avail;
+	off_t entry;
+	off_t lo[numdisks];
+	off_t hi[numdisks];
+	int first_mirror;
+	int last_mirror;
+	int disk;
+	off_t from;
+	off_t to;
+
+	if (getInodeExt(file)->format == INODE_INLINE)
+	{ // Lives in the inode table, which mapDisks already prefetched
+		return;
+	}
+	for (disk = 0; disk < numdisks; disk++)
+	{
+		lo[disk] = hi[disk] = -1;
+	}
+
+	while (index <= last)
+	{
+		entry = getFileRun(file, index, &avail, 0);
+		if (entry == -1)
+		{
+			index++;
+			continue;
+		}
+		avail = MIN(avail, last - index + 1);
+		first_mirror = verified_reads ? 0 : pickMirror(index, start / block_size, last);
+		last_mirror = verified_reads ? numdisks - 1 : first_mirror;
+		for (int mirror = first_mirror; mirror <= last_mirror; mirror++)
+		{
+			disk = getEntryImageDisk(entry, mirror);
+			from = getEntryImageOffset(entry, mirror);
+			to = from + (off_t)avail * block_size;
+			if (lo[disk] != -1 && (to < lo[disk] - READAHEAD_MIN || from > hi[disk] + READAHEAD_MIN))
+			{ // Too far from what is gathered for this disk to share a range
+				prefetchImage(disk, lo[disk], hi[disk]);
+				lo[disk] = -1;
+			}
+			if (lo[disk] == -1)
+			{
+				lo[disk] = from;
+				hi[disk] = to;
+			}
+			lo[disk] = MIN(lo[disk], from);
+			hi[disk] = MAX(hi[disk], to);
+		}
+		index += avail;
+	}
+
+	for (disk = 0; disk < numdisks; disk++)
+	{
+		if (lo[disk] != -1)
+		{
+			prefetchImage(disk, lo[disk], hi[disk]);
+		}
+	}
+}
+
+/** readAhead
+ * Called after each read of size bytes at offset. A read that continues the
+ * last one doubles the readahead window, up to READAHEAD_MAX, and any part of
+ * the window past what was already prefetched gets prefetched. Any other read
+ * ends the stream. An open file has its own stream, reads without one share
+ * the file's. Needs the inode lock held, shared is enough
+ **/
+static void readAhead(struct wfs_inode *file, struct OpenFile *handle, off_t offset, size_t size)
+{
+	struct ReadStream *stream = handle != NULL ? &handle->stream : &read_streams[file->num];
+	off_t start;
+	off_t end;
+
+	if (size == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&stream_lock);
+	if (offset == stream->next)
+	{ // Reading from the start counts as a stream too, like the kernel's readahead
+		stream->window = stream->window == 0 ? READAHEAD_MIN : MIN(stream->window * 2, READAHEAD_MAX);
+	}
+	else
+	{
+		stream->window = 0;
+		stream->ahead = 0;
+	}
+	stream->next = offset + size;
+
+	// Prefetch in steps of at least a quarter window, not a sliver every read
+	start = MAX(stream->ahead, stream->next);
+	end = MIN(stream->next + (off_t)stream->window, file->size);
+	if (stream->window > 0 && start < end && (end - start >= (off_t)stream->window / 4 || end == file->size))
+	{
+		stream->ahead = end;
+	}
+	else
+	{
+		start = end;
+	}
+	pthread_mutex_unlock(&stream_lock);
+
+	if (start < end)
+	{
+		prefetchFile(file, start, end);
+	}
+}
+
+// Clamps a read of size bytes at offset to the end of the file
+static size_t clampRead(struct wfs_inode *file, size_t size, off_t offset)
+{
+	if (offset >= file->size)
+	{
+		LOG_DEBUG("Inode size is %ld\n", file->size);
+		return 0;
+	}
+	if (offset + size > file->size)
+	{
+		return file->size - offset;
+	}
+	return size;
+}
+
+/** copyFileRuns
+ * Copies size bytes at offset, already clamped to the file, into buf, one
+ * memcpy per run from mapReadRun. Inline files are copied from the inode as
+ * metadata sees it, which with a journal is ahead of the image until commit.
+ * Caller holds the inode lock
+ **/
+static size_t copyFileRuns(struct wfs_inode *file, struct OpenFile *handle, char *buf, size_t size, off_t offset)
+{
+	size_t bytes_read = 0;
+	size_t run;
+	int disk;
+	off_t image_off;
+	struct CopyJob *jobs = NULL;
+	int njobs = 0;
+
+	if (getInodeExt(file)->format == INODE_INLINE)
+	{
+		memcpy(buf, getInlineData(file) + offset, size);
+		return size;
+	}
+
+	// Large RAID 0 reads map every run first, then copy them a disk per worker
+	if (useStripeWorkers(size))
+	{
+		jobs = malloc(sizeof(struct CopyJob) * (size / block_size + 2));
+	}
+
+	while (bytes_read < size)
+	{
+		run = mapReadRun(file, handle, offset + bytes_read, size - bytes_read, offset / block_size,
+						 (offset + size - 1) / block_size, &disk, &image_off);
+		if (image_off == -1)
+		{
+			memset(buf + bytes_read, 0, run);
+		}
+		else if (jobs != NULL)
+		{
+			jobs[njobs].disk = disk;
+			jobs[njobs].dst = buf + bytes_read;
+			jobs[njobs].src = data_mappings[disk] + image_off;
+			jobs[njobs].len = run;
+			njobs++;
+		}
+		else
+		{
+			memcpy(buf + bytes_read, data_mappings[disk] + image_off, run);
+		}
+		bytes_read += run;
+	}
+	if (jobs != NULL)
+	{
+		stripeCopy(jobs, njobs);
+		free(jobs);
+	}
+	return bytes_read;
+}
+
+/** readFile
+ * Copies up to size bytes at offset out of the file into buf
+ **/
+static int readFile(struct wfs_inode *file, struct OpenFile *handle, char *buf, size_t size, off_t offset)
+{
+	size_t bytes_read;
+
+	TRACE("read inode %ld offset %ld size %ld", file->num, offset, size);
+	pthread_rwlock_rdlock(&inode_locks[file->num]);
+	bytes_read = copyFileRuns(file, handle, buf, clampRead(file, size, offset), offset);
+	readAhead(file, handle, offset, bytes_read);
+	pthread_rwlock_unlock(&inode_locks[file->num]);
+	return bytes_read;
+}
+
+/** readFileBufs
+ * Like readFile, but instead of copying builds a bufvec whose segments name
+ * the runs inside the disk images so FUSE can splice them to the kernel.
+ * Holes get zeroed memory segments, freed by FUSE along with the bufvec.
+ * Inline files are copied into one memory segment while the inode lock is
+ * held, since FUSE reads segments after it's dropped, when promoteInline may
+ * have cleared the slack. Large RAID 0 reads are copied into one memory
+ * segment too, a disk per stripe worker, since FUSE would copy fd segments
+ * one after another
+ **/
+static int readFileBufs(struct wfs_inode *file, struct OpenFile *handle, struct fuse_bufvec **bufp, size_t size, off_t offset)
+{
+	size_t bytes_read = 0;
+	size_t run;
+	int disk;
+	off_t image_off;
+	struct fuse_bufvec *bufv;
+	struct fuse_buf *seg;
+
+	TRACE("read_buf inode %ld offset %ld size %ld", file->num, offset, size);
+	pthread_rwlock_rdlock(&inode_locks[file->num]);
+	size = clampRead(file, size, offset);
+
+	// Never more runs than blocks touched
+	bufv = malloc(sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf) * (size / block_size + 2));
+	if (bufv == NULL)
+	{
+		pthread_rwlock_unlock(&inode_locks[file->num]);
+		return -ENOMEM;
+	}
+	*bufv = FUSE_BUFVEC_INIT(0);
+	bufv->count = 0;
+
+	if (getInodeExt(file)->format == INODE_INLINE || (raid_mode == 0 && useStripeWorkers(size)))
+	{
+		seg = &bufv->buf[0];
+		*bufv = FUSE_BUFVEC_INIT(size);
+		seg->mem = malloc(size);
+		if (seg->mem != NULL)
+		{
+			seg->size = copyFileRuns(file, handle, seg->mem, size, offset);
+			readAhead(file, handle, offset, seg->size);
+			pthread_rwlock_unlock(&inode_locks[file->num]);
+			*bufp = bufv;
+			return 0;
+		}
+		if (getInodeExt(file)->format == INODE_INLINE && size > 0)
+		{
+			pthread_rwlock_unlock(&inode_locks[file->num]);
+			free(bufv);
+			return -ENOMEM;
+		}
+		*bufv = FUSE_BUFVEC_INIT(0); // Splice the runs after all
+		bufv->count = 0;
+	}
+
+	while (bytes_read < size)
+	{
+		run = mapReadRun(file, handle, offset + bytes_read, size - bytes_read, offset / block_size,
+						 (offset + size - 1) / block_size, &disk, &image_off);
+		seg = &bufv->buf[bufv->count];
+		seg->size = run;
+		if (image_off == -1)
+		{
+			seg->flags = 0;
+			seg->mem = calloc(1, run);
+			seg->fd = -1;
+			seg->pos = 0;
+			if (seg->mem == NULL)
+			{ // Short read of what was mapped so far
+				break;
+			}
+		}
+		else
+		{
+			seg->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			seg->mem = NULL;
+			seg->fd = disks[disk];
+			seg->pos = image_off;
+		}
+		bufv->count++;
+		bytes_read += run;
+	}
+	if (bufv->count == 0)
+	{ // Empty reads still hand back one empty segment
+		*bufv = FUSE_BUFVEC_INIT(0);
+	}
+
+	readAhead(file, handle, offset, bytes_read);
+	pthread_rwlock_unlock(&inode_locks[file->num]);
+	*bufp = bufv;
+	return 0;
+}
+
+static int read1(const char* path, char* buf, size_t size, off_t offset) {
+	int bytes_read;
+
+	// Getting path components
+	char* malleable_path = strdup(path);
+	if(malleable_path == NULL) {
+		LOG_ERROR("Couldn't get malleable path in read\n");
+		return -1;
+	}
+	
+	Path* p = splitPath(malleable_path);
+	if(p == NULL) {
+		LOG_ERROR("Couldn't get path struct in read\n");
+		return -1;
+	}
+
+	struct wfs_inode* my_inode = getInodePath(p, 0);
+	if(my_inode == NULL) {
+		LOG_DEBUG("Couldnt get inode of file to read\n");
+		return -ENOENT;
+	}
+
+	bytes_read = readFile(my_inode, NULL, buf, size, offset);
+
+	for(int i =0;i < p->size;i++) {
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	return bytes_read;
+}
+
+static int read0(const char* path, char* buf, size_t size, off_t offset) {
+	int bytes_read;
+	int disk = 0;
+	// Getting path components
+	char* malleable_path = strdup(path);
+	if(malleable_path == NULL) {
+		LOG_ERROR("Couldn't get malleable path in read\n");
+		return -1;
+	}
+	
+	Path* p = splitPath(malleable_path);
+	if(p == NULL) {
+		LOG_ERROR("Couldn't get path struct in read\n");
+		return -1;
+	}
+
+	struct wfs_inode* my_inode = getInodePath(p, disk);
+	if(my_inode == NULL) {
+		LOG_DEBUG("Couldnt get inode of file to read\n");
+		return -ENOENT;
+	}
+
+	// Entries carry their own disk so any disk works as a starting point
+	bytes_read = readFile(my_inode, NULL, buf, size, offset);
+
+	for(int i =0;i < p->size;i++) {
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	return bytes_read;	
+}
+
+// The open file FUSE handed back, NULL when the request came without one
+static struct OpenFile *getHandle(struct fuse_file_info *fi)
+{
+	if (fi == NULL || fi->fh == 0)
+	{
+		return NULL;
+	}
+	return (struct OpenFile *)(uintptr_t)fi->fh;
+}
+
+static int wfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	int ret_val;
+	Path *p;
+	char *malleable_path;
+	struct wfs_inode *my_inode;
+	struct OpenFile *handle;
+
+	LOG_DEBUG("wfs_read_buf\n");
+	if (isStatsPath(path))
+	{ // One segment FUSE frees along with the vector
+		*bufp = malloc(sizeof(struct fuse_bufvec));
+		if (*bufp == NULL)
+		{
+			return -ENOMEM;
+		}
+		**bufp = FUSE_BUFVEC_INIT(size);
+		(*bufp)->buf[0].mem = malloc(size);
+		if ((*bufp)->buf[0].mem == NULL)
+		{
+			free(*bufp);
+			return -ENOMEM;
+		}
+		(*bufp)->buf[0].size = readStats((struct StatsSnapshot *)(uintptr_t)fi->fh, (*bufp)->buf[0].mem, size, offset);
+		return 0;
+	}
+
+	handle = getHandle(fi);
+	if (handle != NULL)
+	{ // The handle pins the inode, there is no path to walk
+		uint64_t start = statStart();
+		pthread_rwlock_rdlock(&tree_lock);
+		ret_val = readFileBufs(getInode(handle->num, 0), handle, bufp, size, offset);
+		pthread_rwlock_unlock(&tree_lock);
+		statEnd(STAT_READ, start, ret_val == 0 ? fuse_buf_size(*bufp) : 0);
+		return ret_val;
+	}
+
+	malleable_path = strdup(path);
+	if (malleable_path == NULL)
+	{
+		LOG_ERROR("Couldn't get malleable path in read\n");
+		return -1;
+	}
+
+	p = splitPath(malleable_path);
+	if (p == NULL)
+	{
+		LOG_ERROR("Couldn't get path struct in read\n");
+		return -1;
+	}
+
+	// Both modes resolve the path on disk 0, like read0 and read1
+	uint64_t start = statStart();
+	pthread_rwlock_rdlock(&tree_lock);
+	my_inode = getInodePath(p, 0);
+	if (my_inode == NULL)
+	{
+		LOG_DEBUG("Couldnt get inode of file to read\n");
+		ret_val = -ENOENT;
+	}
+	else
+	{
+		ret_val = readFileBufs(my_inode, NULL, bufp, size, offset);
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_READ, start, ret_val == 0 ? fuse_buf_size(*bufp) : 0);
+
+	for (int i = 0; i < p->size; i++)
+	{
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	return ret_val;
+}
+
+static int wfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	int ret_val = -1;
+	struct OpenFile *handle;
+	uint64_t start = statStart();
+	LOG_DEBUG("wfs_read\n");
+	if (isStatsPath(path))
+	{
+		return readStats((struct StatsSnapshot *)(uintptr_t)fi->fh, buf, size, offset);
+	}
+	handle = getHandle(fi);
+	pthread_rwlock_rdlock(&tree_lock);
+	if (handle != NULL) {
+		ret_val = readFile(getInode(handle->num, 0), handle, buf, size, offset);
+	}
+	else if(raid_mode != 0) { // RAID 1 and 1v, which votes in readFile
+		ret_val = read1(path, buf, size, offset);
+	}
+	else {
+		ret_val = read0(path, buf, size, offset);
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_READ, start, ret_val);
+	return ret_val;
+}
+/** extentInsertNode
+ * Maps lblk to pblk in one sorted node of records. The block joins the extent
+ * before or after it when it is physically adjacent, otherwise it gets a new
+ * record. Returns -1 if the node is full
+ **/
+static int extentInsertNode(struct wfs_extent *recs, int *count, int cap, int lblk, off_t pblk)
+{
+	int pos = extentFind(recs, *count, lblk) + 1;
+	struct wfs_extent *prev = pos > 0 ? &recs[pos - 1] : NULL;
+	struct wfs_extent *next = pos < *count ? &recs[pos] : NULL;
+
+	if (prev != NULL && prev->lblk + prev->len == lblk && prev->pblk + (off_t)prev->len * block_size == pblk)
+	{
+		prev->len++;
+		// The gap between prev and next may just have closed
+		if (next != NULL && next->lblk == lblk + 1 && next->pblk == pblk + block_size)
+		{
+			prev->len += next->len;
+			memmove(next, next + 1, sizeof(struct wfs_extent) * (*count - pos - 1));
+			(*count)--;
+		}
+		return 0;
+	}
+	if (next != NULL && next->lblk == lblk + 1 && next->pblk == pblk + block_size)
+	{
+		next->lblk--;
+		next->pblk -= block_size;
+		return 0;
+	}
+
+	if (*count == cap)
+	{
+		return -1;
+	}
+	memmove(&recs[pos + 1], &recs[pos], sizeof(struct wfs_extent) * (*count - pos));
+	recs[pos].lblk = lblk;
+	recs[pos].len = 1;
+	recs[pos].pblk = pblk;
+	(*count)++;
+	return 0;
+}
 
-		parent = getInodePath(p, 0);
-		if (parent == NULL)
+/** extentInsert
+ * Maps logical block lblk of an extent file to pblk. When the records in the
+ * inode fill up they move to a leaf and the inode indexes leaves instead,
+ * full leaves split in half. Returns -1 when the tree can't grow
+ **/
+static int extentInsert(struct wfs_inode *file, int lblk, off_t pblk)
+{
+	struct wfs_inode_ext *ext = getInodeExt(file);
+	struct wfs_extent *recs = getInodeExtents(file);
+	struct wfs_extent_leaf *leaf;
+	struct wfs_extent_leaf *new_leaf;
+	off_t leaf_entry;
+	off_t new_entry;
+	int split;
+	int i;
+
+	if (ext->depth == 0)
+	{
+		if (extentInsertNode(recs, &ext->count, INODE_EXTENTS, lblk, pblk) == 0)
 		{
-			printf("Error getting parent\n");
+			return 0;
 		}
 
-		child = allocateInode(0);
-		if (child == NULL)
+		// Out of room in the inode, the records become the first leaf
+		leaf_entry = allocateFileBlock();
+		if (leaf_entry == -1)
 		{
-			printf("Error allocating child\n");
-			return -ENOSPC;
+			return -1;
 		}
+		leaf = (struct wfs_extent_leaf *)getEntryPtr(leaf_entry, 0);
+		leaf->count = ext->count;
+		memcpy(leaf->extents, recs, sizeof(struct wfs_extent) * ext->count);
+		syncMapBlock(leaf_entry);
+		recs[0].lblk = leaf->extents[0].lblk;
+		recs[0].len = 0;
+		recs[0].pblk = leaf_entry;
+		ext->count = 1;
+		ext->depth = 1;
+	}
 
-		child->mode |= mode;
-		child->mode |= S_IFDIR;
+	i = extentFind(recs, ext->count, lblk);
+	if (i == -1)
+	{
+		i = 0;
+	}
+	leaf = (struct wfs_extent_leaf *)getEntryPtr(recs[i].pblk, 0);
 
-		if (linkdir(parent, child, dir_name, 0) == -1)
+	if (extentInsertNode(leaf->extents, &leaf->count, leafExtents(), lblk, pblk) != 0)
+	{
+		if (ext->count == INODE_EXTENTS)
 		{
-			printf("Linking error\n");
+			LOG_WARN("Extent tree is full\n");
+			return -1;
 		}
 
-		struct wfs_inode* first; 
-		struct wfs_inode* second;
-		for(int k = 1; k < numdisks;k++) {
-		first = (struct wfs_inode*)(mappings[0] + superblocks[0]->i_blocks_ptr);
-		second = (struct wfs_inode*)(mappings[k] + superblocks[k]->i_blocks_ptr);
-		for(int i = 0; i < superblocks[0]->num_inodes;i++){
-			memcpy(second, first, sizeof(struct wfs_inode));
-			printf("First num is %d\nSecond num is %d\n", first->num, second->num);
-			first = (struct wfs_inode*)((char*)first + BLOCK_SIZE);
-			second = (struct wfs_inode*)((char*)second + BLOCK_SIZE);
+		// Split, the upper half moves to a new leaf indexed right after this one.
+		// Appends past the last leaf start an empty leaf so full leaves stay full
+		split = leaf->count / 2;
+		if (i == ext->count - 1 && lblk > leaf->extents[leaf->count - 1].lblk)
+		{
+			split = leaf->count;
+		}
+		new_entry = allocateFileBlock();
+		if (new_entry == -1)
+		{
+			return -1;
+		}
+		new_leaf = (struct wfs_extent_leaf *)getEntryPtr(new_entry, 0);
+		new_leaf->count = leaf->count - split;
+		memcpy(new_leaf->extents, &leaf->extents[split], sizeof(struct wfs_extent) * new_leaf->count);
+		leaf->count = split;
+
+		memmove(&recs[i + 2], &recs[i + 1], sizeof(struct wfs_extent) * (ext->count - i - 1));
+		recs[i + 1].lblk = new_leaf->count > 0 ? new_leaf->extents[0].lblk : lblk;
+		recs[i + 1].len = 0;
+		recs[i + 1].pblk = new_entry;
+		ext->count++;
+		syncMapBlock(recs[i].pblk);
+
+		if (lblk >= recs[i + 1].lblk)
+		{
+			i++;
+			leaf = new_leaf;
+		}
+		else
+		{
+			syncMapBlock(new_entry);
 		}
+		extentInsertNode(leaf->extents, &leaf->count, leafExtents(), lblk, pblk);
+	}
 
-		// Copying inode bitmaps
-		memcpy(superblocks[k], superblocks[0], superblocks[0]->d_bitmap_ptr);
-		
+	// The leaf may now start lower than its index record said
+	if (leaf->extents[0].lblk < recs[i].lblk)
+	{
+		recs[i].lblk = leaf->extents[0].lblk;
 	}
-	
+	syncMapBlock(recs[i].pblk);
 	return 0;
 }
 
-static int wfs_mkdir1(const char *path, mode_t mode)
+/** mapBlockForWriteExtent
+ * Returns the entry of the index'th block of an extent file, allocating it
+ * when it isn't mapped yet
+ **/
+static off_t mapBlockForWriteExtent(struct wfs_inode *file, int index)
 {
-	for (int disk = 0; disk < numdisks; disk++)
+	int len;
+	off_t entry = extentLookup(file, index, &len, 0);
+
+	if (entry != -1)
 	{
-		printf("wfs_mkdir\n");
-		char *malleable_path;
-		Path *p;
-		char *dir_name;
-		struct wfs_inode *parent;
-		struct wfs_inode *child;
+		return entry;
+	}
+	entry = allocateDataBlock(index >= allocStride() ? extentLookup(file, index - allocStride(), &len, 0) : -1, index);
+	if (entry == -1)
+	{
+		return -1;
+	}
+	if (extentInsert(file, index, entry) != 0)
+	{
+		releaseFileBlock(entry);
+		return -1;
+	}
+	return entry;
+}
 
-		// Making path modifiable
-		malleable_path = strdup(path);
-		if (malleable_path == NULL)
-		{
-			return -1;
-		}
+static off_t mapBlockForWrite(struct wfs_inode *file, int index)
+{
+	if (getInodeExt(file)->format == INODE_EXTENT)
+	{
+		return mapBlockForWriteExtent(file, index);
+	}
+	int len;
+	return mapIndirect(file, index, 1, 0, &len);
+}
 
-		p = splitPath(malleable_path); // Break apart path
+// Copies an inode changed on disk 0 to the other disks, slack included
+static void mirrorInode(struct wfs_inode *file)
+{
+	for (int disk = 1; disk < numdisks; disk++)
+	{
+		memcpy(getInode(file->num, disk), file, BLOCK_SIZE);
+		markInodeDirty(getInode(file->num, disk));
+	}
+	markInodeDirty(file);
+}
 
-		for (int i = 0; i < p->size; i++)
+/** writeInline
+ * Writes src at offset into the data of an inline file, the caller checked
+ * that it fits
+ **/
+static int writeInline(struct wfs_inode *file, struct fuse_bufvec *src, off_t offset)
+{
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(src));
+	ssize_t copied;
+
+	dst.buf[0].mem = getInlineData(file) + offset;
+	copied = fuse_buf_copy(&dst, src, 0);
+	if (copied < 0)
+	{
+		return copied;
+	}
+	if (offset + copied > file->size)
+	{
+		file->size = offset + copied;
+	}
+	mirrorInode(file);
+	return copied;
+}
+
+/** promoteInline
+ * Moves the data of an inline file into its first block and gives the inode
+ * the filesystem's mapped format. Returns -1 and leaves the file inline if
+ * no block is free
+ **/
+static int promoteInline(struct wfs_inode *file)
+{
+	unsigned char data[INLINE_DATA];
+	size_t size = file->size;
+	off_t entry;
+
+	memcpy(data, getInlineData(file), size);
+	clearInodeSlack(file);
+	setMappedFormat(file);
+	if (size == 0)
+	{
+		return 0;
+	}
+
+	entry = mapBlockForWrite(file, 0);
+	if (entry == -1)
+	{
+		clearInodeSlack(file);
+		getInodeExt(file)->format = INODE_INLINE;
+		memcpy(getInlineData(file), data, size);
+		return -1;
+	}
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
+	{
+		memcpy(getDataPtr(entry, disk), data, size);
+		markDirty(getDataPtr(entry, disk), size);
+	}
+	return 0;
+}
+
+/** writeFile
+ * Writes the contents of src at offset. Every block of the range is mapped
+ * (and allocated) first, then fuse_buf_copy moves the data straight into the
+ * image, out of FUSE's pipe when the write was spliced. RAID 1 mirrors get
+ * the same bytes afterwards. Caller holds the inode lock
+ **/
+static int writeFile(struct wfs_inode *file, struct fuse_bufvec *src, off_t offset)
+{
+	size_t size = fuse_buf_size(src);
+	size_t mapped = 0;
+	size_t chunk;
+	ssize_t copied = 0;
+	int index;
+	int in_block;
+	off_t entry;
+	off_t prev_entry = -1;
+	struct fuse_bufvec *dst;
+	struct fuse_buf *seg = NULL;
+
+	if (getInodeExt(file)->format == INODE_INLINE)
+	{
+		if (offset + size <= (size_t)INLINE_DATA)
 		{
-			printf("Path component [%d]: %s\n", i, p->path_components[i]);
+			return writeInline(file, src, offset);
 		}
-
-		// Checking if this file already exists
-		if (getInodePath(p, disk) != NULL)
+		if (promoteInline(file) != 0)
 		{
-			printf("File already exists\n");
-			return -EEXIST;
+			return -ENOSPC;
 		}
+	}
 
-		// Strip last element but save name
-		dir_name = p->path_components[p->size - 1];
-		p->size--;
+	// At most one segment per block touched
+	dst = malloc(sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf) * (size / block_size + 2));
+	if (dst == NULL)
+	{
+		return -ENOMEM;
+	}
+	*dst = FUSE_BUFVEC_INIT(0);
+	dst->count = 0;
 
-		parent = getInodePath(p, disk);
-		if (parent == NULL)
+	while (mapped < size)
+	{
+		index = (offset + mapped) / block_size;
+		in_block = (offset + mapped) % block_size;
+		chunk = block_size - in_block;
+		if (chunk > size - mapped)
 		{
-			printf("Error getting parent\n");
+			chunk = size - mapped;
 		}
 
-		child = allocateInode(disk);
-		if (child == NULL)
+		entry = mapBlockForWrite(file, index);
+		if (entry == -1)
+		{ // If still not allocated then exit on error of no space
+			LOG_WARN("Cant allocate more file for write\n");
+			break;
+		}
+		// Physically contiguous blocks share a segment
+		if (seg != NULL && entry == prev_entry + block_size)
 		{
-			printf("Error allocating child\n");
-			return -ENOSPC;
+			seg->size += chunk;
 		}
+		else
+		{
+			seg = &dst->buf[dst->count++];
+			seg->size = chunk;
+			seg->flags = 0;
+			seg->mem = getDataPtr(entry, 0) + in_block;
+			seg->fd = -1;
+			seg->pos = 0;
+		}
+		prev_entry = entry;
+		mapped += chunk;
+	}
 
-		child->mode |= mode;
-		child->mode |= S_IFDIR;
-
-		if (linkdir(parent, child, dir_name, disk) == -1)
+	if (dst->count > 0 && raid_mode == 0 && useStripeWorkers(mapped) && src->count == 1 && !(src->buf[0].flags & FUSE_BUF_IS_FD))
+	{ // A memory payload splits into a copy per segment, a disk per worker
+		struct CopyJob *jobs = malloc(sizeof(struct CopyJob) * dst->count);
+		off_t image_off;
+		if (jobs != NULL)
 		{
-			printf("Linking error\n");
+			for (size_t i = 0; i < dst->count; i++)
+			{
+				jobs[i].disk = imageDisk(dst->buf[i].mem, &image_off);
+				jobs[i].dst = dst->buf[i].mem;
+				jobs[i].src = (char *)src->buf[0].mem + src->off + copied;
+				jobs[i].len = dst->buf[i].size;
+				copied += dst->buf[i].size;
+			}
+			stripeCopy(jobs, dst->count);
+			free(jobs);
 		}
-		
-		free(dir_name);
-		for(int i = 0; i < p->size;i++) {
-			free(p->path_components[i]);
+	}
+	if (dst->count > 0 && copied == 0)
+	{ // Small, spliced, or the jobs couldn't be allocated
+		copied = fuse_buf_copy(dst, src, 0);
+	}
+	if (copied < 0)
+	{
+		free(dst);
+		return copied;
+	}
+	for (size_t i = 0; i < dst->count; i++)
+	{
+		markDirty(dst->buf[i].mem, dst->buf[i].size);
+	}
+
+	// Same bytes at the same offset on every mirror
+	if (raid_mode == 1)
+	{
+		size_t left = copied;
+		for (size_t i = 0; i < dst->count && left > 0; i++)
+		{
+			chunk = dst->buf[i].size < left ? dst->buf[i].size : left;
+			for (int disk = 1; disk < numdisks; disk++)
+			{
+				memcpy(data_mappings[disk] + ((unsigned char *)dst->buf[i].mem - data_mappings[0]), dst->buf[i].mem, chunk);
+				markDirty(data_mappings[disk] + ((unsigned char *)dst->buf[i].mem - data_mappings[0]), chunk);
+			}
+			left -= chunk;
 		}
-		free(p);
-		free(malleable_path);
 	}
-	
-	return 0;
+	free(dst);
+
+	if (offset + copied > file->size)
+	{
+		file->size = offset + copied;
+	}
+
+	// Inodes are mirrored in both modes
+	mirrorInode(file);
+
+	if (copied == 0 && size > 0)
+	{
+		return -ENOSPC;
+	}
+	return copied;
+}
+
+/** writeInode
+ * Writes src into the file at offset under its inode lock, with what it
+ * dirties put on the file's list
+ **/
+static int writeInode(struct wfs_inode *my_file, struct fuse_bufvec *src, off_t offset)
+{
+	int written_bytes;
+
+	TRACE("write inode %ld offset %ld size %ld", my_file->num, offset, fuse_buf_size(src));
+	journalOpBegin();
+	pthread_rwlock_wrlock(&inode_locks[my_file->num]);
+	dirty_owner = my_file->num;
+	written_bytes = writeFile(my_file, src, offset);
+	dirty_owner = -1;
+	pthread_rwlock_unlock(&inode_locks[my_file->num]);
+	if (written_bytes <= 0)
+	{
+		journalOpEnd();
+	}
+	else if (syncOp(my_file->num) != 0)
+	{
+		written_bytes = -EIO;
+	}
+	return written_bytes;
+}
+
+/** writePath
+ * Resolves path and writes src into the file at offset
+ **/
+static int writePath(const char *path, struct fuse_bufvec *src, off_t offset)
+{
+	int written_bytes;
+	Path* p;
+	char* malleable_path;
+	struct wfs_inode* my_file;
+
+	malleable_path = strdup(path);
+	if (malleable_path == NULL)
+	{
+		LOG_ERROR("Couldnt create malleable_path\n");
+		return -1;
+	}
+
+	p = splitPath(malleable_path);
+	if (p == NULL)
+	{
+		LOG_ERROR("Couldnt split path\n");
+		return -1;
+	}
+
+	my_file = getInodePath(p, 0);
+	if (my_file == NULL)
+	{
+		LOG_DEBUG("File does not exist\n");
+		return -ENOENT;
+	}
+	LOG_DEBUG("my_file->num: %d\n", my_file->num);
+
+	written_bytes = writeInode(my_file, src, offset);
+
+	for(int i =0;i<p->size;i++) {
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	return written_bytes;
+}
+
+static int wfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
+	int ret_val;
+	struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+	uint64_t start = statStart();
+	src.buf[0].mem = (void *)buf;
+
+	// Writes only change their own file, the tree lock just keeps the path stable
+	pthread_rwlock_rdlock(&tree_lock);
+	if (getHandle(fi) != NULL)
+	{
+		ret_val = writeInode(getInode(getHandle(fi)->num, 0), &src, offset);
+	}
+	else
+	{
+		ret_val = writePath(path, &src, offset);
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_WRITE, start, ret_val);
+	return ret_val;
+
+}
+
+static int wfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	LOG_DEBUG("wfs_write_buf\n");
+	pthread_rwlock_rdlock(&tree_lock);
+	if (getHandle(fi) != NULL)
+	{
+		ret_val = writeInode(getInode(getHandle(fi)->num, 0), buf, offset);
+	}
+	else
+	{
+		ret_val = writePath(path, buf, offset);
+	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_WRITE, start, ret_val);
+	return ret_val;
+}
+// Fills stbuf in from an inode
+static void fillStat(struct wfs_inode *my_inode, struct stat *stbuf)
+{
+	pthread_rwlock_rdlock(&inode_locks[my_inode->num]);
+	stbuf->st_dev = 0;
+	stbuf->st_ino = my_inode->num;
+	stbuf->st_mode = my_inode->mode;
+	stbuf->st_nlink = my_inode->nlinks;
+	stbuf->st_uid = my_inode->uid;
+	stbuf->st_gid = my_inode->gid;
+	stbuf->st_rdev = 0;
+	stbuf->st_size = my_inode->size;
+	stbuf->st_blksize = block_size;
+	stbuf->st_blocks = my_inode->size / BLOCK_SIZE;
+	pthread_rwlock_unlock(&inode_locks[my_inode->num]);
+}
+
+static int getattrPath(const char *path, struct stat *stbuf)
+{
+	LOG_DEBUG("wfs_getattr\n");
+	LOG_DEBUG("Path is %s\n", path);
+	Path *p;
+	struct wfs_inode *my_inode;
+	char *malleable_path;
+	malleable_path = strdup(path);
+
+	if (malleable_path == NULL)
+	{
+		return -1;
+	}
+	p = splitPath(malleable_path);
+	if(p== NULL) {
+		return -1;
+	}
+	
+	my_inode = getInodePath(p, 0);
+	if (my_inode == NULL)
+	{
+		return -ENOENT;
+	}
+
+	fillStat(my_inode, stbuf);
+	LOG_DEBUG("wfs_getattr done\n");
+
+	for(int i =0;i < p->size;i++) {
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	
+	return 0;
+}
+
+static int wfs_getattr(const char *path, struct stat *stbuf)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	if (isStatsPath(path))
+	{
+		statsStat(stbuf, superblocks[0]->num_inodes);
+		return 0;
+	}
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = getattrPath(path, stbuf);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_GETATTR, start, 0);
+	return ret_val;
 }
 
-static int wfs_mkdir(const char *path, mode_t mode)
+// fstat and the getattr after create, straight from the handle
+static int wfs_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
 {
-	if(raid_mode == 0) {
-		return wfs_mkdir0(path, mode);
-	}
-	else if(raid_mode == 1) {
-		return wfs_mkdir1(path, mode);
+	uint64_t start;
+	if (isStatsPath(path) || getHandle(fi) == NULL)
+	{ // Only open files have handles, and a removed directory has no path
+		return path == NULL ? -ENOENT : wfs_getattr(path, stbuf);
 	}
-	return -1;
+	start = statStart();
+	pthread_rwlock_rdlock(&tree_lock);
+	fillStat(getInode(getHandle(fi)->num, 0), stbuf);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_GETATTR, start, 0);
+	return 0;
 }
-// Remove (delete) the given file, symbolic link, hard link, or special node.
-//  Note that if you support hard links, unlink only deletes the data when the last hard link is removed.
-//  See unlink(2) for details.
-//  To delete files, you should free (unallocate) any data blocks associated with the file, free it's inode,
-// and remove the directory entry pointing to the file from the parent inode.
 
-static int wfs_unlink(const char *path)
+/** openInode
+ * Opens inode num, a handle pinning it goes in fi->fh
+ **/
+static int openInode(int num, struct fuse_file_info *fi)
 {
-	printf("unlink(): path: %s\n",  path);
-	// get the dir and file inode
-	struct wfs_inode *directory;
-	struct wfs_inode *file;
-	char *file_name;
-	// RAID 1:
+	struct OpenFile *handle;
 
-	for (int disk = 0; disk < numdisks; disk++)
+	handle = calloc(1, sizeof(struct OpenFile));
+	if (handle == NULL)
 	{
-		char *pathcpy = strdup(path);
-		if (pathcpy == NULL)
-		{
-			printf("fialed strdup unlink\n");
-			return -1;
-		}
-		Path *splitpath = splitPath(pathcpy);
-		file_name = splitpath->path_components[splitpath->size-1];
+		return -ENOMEM;
+	}
+	handle->num = num;
+	TRACE("open inode %ld", num, 0, 0);
+	pthread_mutex_init(&handle->lock, NULL);
+	pthread_mutex_lock(&open_lock);
+	open_counts[num]++;
+	pthread_mutex_unlock(&open_lock);
+	fi->fh = (uintptr_t)handle;
+	return 0;
+}
 
-		if ((file = getInodePath(splitpath, disk)) == NULL)
-		{
-			printf("File doesnt exists\n");
-			return -ENOENT;
-		}
+/** openPath
+ * Opens the file at path
+ **/
+static int openPath(const char *path, struct fuse_file_info *fi)
+{
+	char *malleable_path;
+	Path *p;
+	struct wfs_inode *inode;
 
-		
-		if(splitpath->size > 1){
-			splitpath->size--;
-			directory = getInodePath(splitpath, disk);
-		} else {
-			// IF ROOT
-			directory = roots[disk];
-		}
+	malleable_path = strdup(path);
+	if (malleable_path == NULL)
+	{
+		return -ENOMEM;
+	}
+	p = splitPath(malleable_path);
+	if (p == NULL)
+	{
+		free(malleable_path);
+		return -ENOMEM;
+	}
+	inode = getInodePath(p, 0);
+	for (int i = 0; i < p->size; i++)
+	{
+		free(p->path_components[i]);
+	}
+	free(p);
+	free(malleable_path);
+	if (inode == NULL)
+	{
+		return -ENOENT;
+	}
+	return openInode(inode->num, fi);
+}
 
-		if (directory == NULL)
+static int wfs_open(const char *path, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	LOG_DEBUG("wfs_open\n");
+	if (isStatsPath(path))
+	{
+		if ((fi->flags & O_ACCMODE) != O_RDONLY)
 		{
-			printf("Error getting directory\n");
-			return -ENOENT;
+			return -EACCES;
 		}
+		fi->fh = (uintptr_t)openStats();
+		fi->direct_io = 1;
+		return fi->fh == 0 ? -ENOMEM : 0;
+	}
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = openPath(path, fi);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_OPEN, start, 0);
+	return ret_val;
+}
 
-		if (deleteDentry(directory, file_name, disk) != 0)
-		{
-			printf("failed to remove file's dentry from dir\n");
-			return -1;
-		}
+static int wfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
+	LOG_DEBUG("wfs_create\n");
+	ret_val = mknodPath(path, mode, 0);
+	if (ret_val == 0)
+	{
+		pthread_rwlock_rdlock(&tree_lock);
+		ret_val = openPath(path, fi);
+		pthread_rwlock_unlock(&tree_lock);
+	}
+	statEnd(STAT_CREATE, start, 0);
+	return ret_val;
+}
 
-		// DELETE FILE IF NLINKS== 0
-		file->nlinks--;
-		if (file->nlinks == 0)
-		{
-			// TODO: UNCLEAR WHETHER WE MUST ZERO THESE OUT
-			//  free the direct blocks
-			printf("am deleting file\n");
-			int block_num;
-			for (int d = 0; d < N_BLOCKS -1; d++)
-			{
-				if(file->blocks[d] == -1){
-					continue;
-				}
-				block_num = file->blocks[d] / BLOCK_SIZE;
-				printf("direct blockk num: %d\n", block_num);
-				void *block = mappings[disk] + superblocks[disk]->d_blocks_ptr + file->blocks[d];
-				if (memset(block, 0, BLOCK_SIZE) != block)
-				{
-					printf("unlink(): memset failed\n");
-					return -1;
-				}
-		
-				markbitmap_d(block_num, 0, disk);
-			}
+/** releaseHandle
+ * Drops a handle. The last handle of a file that was unlinked while open
+ * frees it
+ **/
+static int releaseHandle(struct fuse_file_info *fi)
+{
+	struct OpenFile *handle = getHandle(fi);
+	int num;
+	int last;
+	int orphan = 0;
 
-			// free the indirect blocks
-			if (file->blocks[IND_BLOCK] != -1)
-			{
-				struct IndirectBlock *indirect_block = (struct IndirectBlock *)(mappings[disk] + superblocks[disk]->d_blocks_ptr + file->blocks[IND_BLOCK]);
-				printf("freeing indireict blocks\n");
-				for (int i = 0; i < BLOCK_SIZE/sizeof(off_t); i++)
-				{
-					if(indirect_block->blocks[i] == -1){
-						continue;
-					}	
-					block_num = indirect_block->blocks[i] / BLOCK_SIZE;
-					printf("i: %d freeing indirect block %d\n", i, block_num);
-					void *block = mappings[disk] + superblocks[disk]->d_blocks_ptr + indirect_block->blocks[i];
-						
-					if (memset(block, 0, BLOCK_SIZE) != block)
-					{
-						printf("unlink(): memset failed\n");
-					}
-
-					markbitmap_d(block_num, 0, disk);
-				}
-				block_num = file->blocks[IND_BLOCK] / BLOCK_SIZE;
-				markbitmap_d(block_num, 0, disk);
-				void *block = mappings[disk] + superblocks[disk]->d_blocks_ptr + indirect_block->blocks[IND_BLOCK];
-				if (memset(block, 0, BLOCK_SIZE) != block)
-				{
-					printf("unlink(): memset failed\n");
-				}
-	
-			}
+	if (handle == NULL)
+	{
+		return 0;
+	}
+	num = handle->num;
+	TRACE("release inode %ld", num, 0, 0);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+	fi->fh = 0;
+
+	pthread_mutex_lock(&open_lock);
+	last = --open_counts[num] == 0;
+	pthread_mutex_unlock(&open_lock);
+	if (!last)
+	{
+		return 0;
+	}
 
-			// Free the inode
-			int inode_num = file->num;
-			if (memset((void *)file, 0, BLOCK_SIZE) != (void *)file)
-			{
-				printf("unlink(): c0ing inode  failed\n");
-			}
-			markbitmap_i(inode_num, 0, disk);
-		}
+	// unlink only changes nlinks under the exclusive tree lock
+	pthread_rwlock_rdlock(&tree_lock);
+	orphan = checkIBitmap(num, 0) && getInode(num, 0)->nlinks == 0;
+	pthread_rwlock_unlock(&tree_lock);
+	if (!orphan)
+	{
+		return 0;
+	}
 
-		// remove the directory entry to the file
-		
-	
-//		if (deleteDentry(directory, file_name, disk) != 0)
-//		{
-//			printf("failed to remove file's dentry from dir\n");
-//			return -1;
-//		}
+	pthread_rwlock_wrlock(&tree_lock);
+	pthread_mutex_lock(&open_lock);
+	orphan = open_counts[num] == 0 && checkIBitmap(num, 0) && getInode(num, 0)->nlinks == 0;
+	pthread_mutex_unlock(&open_lock);
+	if (orphan)
+	{
+		journalOpBegin();
+		freeInodeAll(num);
+		syncOp(-1);
 	}
+	pthread_rwlock_unlock(&tree_lock);
 	return 0;
 }
-static int wfs_mknod1(const char *path, mode_t mode, dev_t rdev)
+
+static int wfs_release(const char *path, struct fuse_file_info *fi)
 {
-	for (int disk = 0; disk < numdisks; disk++)
+	int ret_val;
+	uint64_t start = statStart();
+	LOG_DEBUG("wfs_release\n");
+	if (isStatsPath(path))
 	{
-		printf("wfs_mknod\n");
-		char *malleable_path;
-		Path *p;
-		char *dir_name;
-		struct wfs_inode *parent;
-		struct wfs_inode *child;
-
-		// Making path modifiable
-		malleable_path = strdup(path);
-		if (malleable_path == NULL)
-		{
-			printf("couldnt get malleable path\n");
-			return -1;
-		}
-
-		p = splitPath(malleable_path); // Break apart path
-
-		for (int i = 0; i < p->size; i++)
-		{
-			printf("Path component [%d]: %s\n", i, p->path_components[i]);
-		}
-
-		if (getInodePath(p, disk) != NULL)
-		{
-			printf("File already exists\n");
-			return -EEXIST;
-		}
-
-		// Strip last element but save name
-		dir_name = p->path_components[p->size - 1];
-		p->size--;
-
-		parent = getInodePath(p, disk);
-		if (parent == NULL)
-		{
-			printf("Error getting parent\n");
-			return -1;
-		}
-
-		child = allocateInode(disk);
-		if (child == NULL)
-		{
-			printf("Error allocating child\n");
-			return -ENOSPC;
-		}
+		closeStats((struct StatsSnapshot *)(uintptr_t)fi->fh);
+		return 0;
+	}
+	ret_val = releaseHandle(fi);
+	statEnd(STAT_RELEASE, start, 0);
+	return ret_val;
+}
 
-		child->mode |= mode;
+/** fsyncInode
+ * Makes what was written to an inode durable, or with wait unset only starts
+ * writing it back
+ **/
+static int fsyncInode(int num, int wait)
+{
+	int ret_val = 0;
 
-		if (linkdir(parent, child, dir_name, disk) == -1)
+	if (wait)
+	{
+		ret_val = journalCommit();
+		if (syncInode(num) != 0)
 		{
-			printf("Linking error\n");
-		}
-		for(int i =0; i < p->size;i++) {
-			free(p->path_components[i]);
+			ret_val = -EIO;
 		}
-		free(p);
-		free(dir_name);
 	}
-
-	printf("mknod done\n");
-	return 0;
+	else
+	{
+		startInodeWriteback(num);
+	}
+	return ret_val;
 }
 
-static int wfs_mknod0(const char *path, mode_t mode, dev_t rdev)
+/** fsyncPath
+ * Makes what was written to the file or directory at path durable
+ **/
+static int fsyncPath(const char *path, int wait)
 {
-
-	printf("wfs_mknod\n");
 	char *malleable_path;
 	Path *p;
-	char *dir_name;
-	struct wfs_inode *parent;
-	struct wfs_inode *child;
+	struct wfs_inode *inode;
 
-	// Making path modifiable
+	if (path == NULL)
+	{ // A directory removed while open, nothing left to sync
+		return -ENOENT;
+	}
 	malleable_path = strdup(path);
 	if (malleable_path == NULL)
 	{
-		printf("couldnt get malleable path\n");
-		return -1;
+		return -ENOMEM;
 	}
-
-	p = splitPath(malleable_path); // Break apart path
-
-	for (int i = 0; i < p->size; i++)
+	p = splitPath(malleable_path);
+	if (p == NULL)
 	{
-		printf("Path component [%d]: %s\n", i, p->path_components[i]);
+		free(malleable_path);
+		return -ENOMEM;
 	}
-
-	if (getInodePath(p, 0) != NULL)
+	inode = getInodePath(p, 0);
+	for (int i = 0; i < p->size; i++)
 	{
-		printf("File already exists\n");
-		return -EEXIST;
+		free(p->path_components[i]);
 	}
-
-	// Strip last element but save name
-	dir_name = p->path_components[p->size - 1];
-	p->size--;
-
-	parent = getInodePath(p, 0);
-	if (parent == NULL)
+	free(p);
+	free(malleable_path);
+	if (inode == NULL)
 	{
-		printf("Error getting parent\n");
-		return -1;
+		return -ENOENT;
 	}
+	return fsyncInode(inode->num, wait);
+}
 
-	child = allocateInode(0);
-	if (child == NULL)
+static int wfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
+
+	if (durability == DURABLE_NONE || isStatsPath(path))
 	{
-		printf("Error allocating child\n");
-		return -ENOSPC;
+		return 0;
 	}
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = getHandle(fi) != NULL ? fsyncInode(getHandle(fi)->num, 1) : fsyncPath(path, 1);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_FSYNC, start, 0);
+	return ret_val;
+}
 
-	printf("Child number is %d\n", child->num);
-
-	child->mode |= mode;
+// Called on every close, only starts writeback so close doesn't wait on the disk
+static int wfs_flush(const char *path, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
 
-	if (linkdir(parent, child, dir_name, 0) == -1)
+	if (durability != DURABLE_FSYNC || isStatsPath(path))
 	{
-		printf("Linking error\n");
+		return 0;
 	}
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = getHandle(fi) != NULL ? fsyncInode(getHandle(fi)->num, 0) : fsyncPath(path, 0);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_FLUSH, start, 0);
+	return ret_val;
+}
 
-	struct wfs_inode* first; 
-	struct wfs_inode* second;
-	for(int k = 1; k < numdisks;k++) {
-	first = (struct wfs_inode*)(mappings[0] + superblocks[0]->i_blocks_ptr);
-	second = (struct wfs_inode*)(mappings[k] + superblocks[k]->i_blocks_ptr);
-		for(int i = 0; i < superblocks[k]->num_inodes;i++){
-			memcpy(second, first, sizeof(struct wfs_inode));
-			first = (struct wfs_inode*)((char*)first + BLOCK_SIZE);
-			second = (struct wfs_inode*)((char*)second + BLOCK_SIZE);
-		}
-
-		// Copying inode bitmaps
-		memcpy(superblocks[k], superblocks[0], superblocks[0]->d_bitmap_ptr);		
-	}
+static struct fuse_operations ops = {
+	.getattr = wfs_getattr,
+	.fgetattr = wfs_fgetattr,
+	.open = wfs_open,
+	.create = wfs_create,
+	.release = wfs_release,
+	.mknod = wfs_mknod,
+	.mkdir = wfs_mkdir,
+	.unlink = wfs_unlink,
+	.rmdir = wfs_rmdir,
+	.read = wfs_read,
+	.write = wfs_write,
+	.read_buf = wfs_read_buf,
+	.write_buf = wfs_write_buf,
+	.readdir = wfs_readdir,
+	.fsync = wfs_fsync,
+	.fsyncdir = wfs_fsync,
+	.flush = wfs_flush,
+	.init = wfs_init,
+	.destroy = wfs_destroy,
+	.flag_nullpath_ok = 1, // Handles outlive their path once the file is unlinked
+};
 
-	printf("mknod done\n");
-	
-	return 0;
-}
+// ------------LOW-LEVEL BACKEND-----------------
+// With -o lowlevel the kernel talks to wfs in inode numbers. FUSE's root is
+// node 1 and ours is inode 0, so node ids are inode numbers plus one and no
+// request ever walks a path. The stats file takes the node id right past
+// the inode table
 
-static int wfs_mknod(const char *path, mode_t mode, dev_t rdev)
+// A directory's entries as ll_opendir packed them for readdir
+struct DirListing
 {
-	if(raid_mode == 0) {
-		return wfs_mknod0(path, mode, rdev);
-	}
-	else if(raid_mode == 1) {
-		return wfs_mknod1(path, mode, rdev);
+	fuse_req_t req;
+	char *buf;
+	size_t size;
+	size_t cap;
+};
+
+// The inode behind a node id, NULL when it's out of range or free
+static struct wfs_inode *nodeInode(fuse_ino_t ino)
+{
+	if (ino < FUSE_ROOT_ID || ino - FUSE_ROOT_ID >= (fuse_ino_t)superblocks[0]->num_inodes ||
+		!checkIBitmap(ino - FUSE_ROOT_ID, 0))
+	{
+		return NULL;
 	}
-	return 0;
+	return getInode(ino - FUSE_ROOT_ID, 0);
 }
 
-static int wfs_rmdir(const char *path)
+// The node id of the stats file
+static fuse_ino_t statsNode()
 {
+	return superblocks[0]->num_inodes + FUSE_ROOT_ID;
+}
 
-	for(int disk = 0;disk<numdisks;disk++) {
-		
-	
-		printf("wfs_rmdir()\n");
-
-		char* malleable_path;
-		Path* p;
-		char* dir_name;
-		struct wfs_inode* my_inode;
-		struct wfs_inode* parent;
-		malleable_path = strdup(path);
-		if(malleable_path == NULL) {
-			printf("Cant get path for dir\n");
-			return -1;
-		}
+// Fills an entry reply in, a NULL inode gives the negative entry for a miss
+static void fillEntry(struct wfs_inode *inode, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->attr_timeout = cache_timeout;
+	e->entry_timeout = cache_timeout;
+	if (inode != NULL)
+	{ // Node ids are reused inode numbers, the generation tells the uses apart
+		e->ino = inode->num + FUSE_ROOT_ID;
+		e->generation = getInodeExt(inode)->generation;
+		fillStat(inode, &e->attr);
+		e->attr.st_ino = e->ino;
+	}
+}
 
-		p = splitPath(malleable_path);
-		if(p == NULL) {
-			printf("Couldn't split path\n");
-			return -1;
-		}
+static struct fuse_chan *ll_chan; // Where notifications go, NULL when no session runs
 
-		// Getting the dir to be removed
-		my_inode = getInodePath(p, disk);
-		if(my_inode == NULL) {
-			printf("Error allocating inode in rmdir\n");
-			return -1;
-		}
+// A name to drop from the kernel's dentry cache, queued for the notifier
+struct EntryInval
+{
+	fuse_ino_t parent;
+	char name[MAX_NAME + 1];
+	struct EntryInval *next;
+};
 
-		// Allocating child name
-		dir_name = strdup(p->path_components[p->size-1]);
-		if(dir_name == NULL) {
-			printf("Dir name couldnt alloc in rmdir\n");
-			return -1;
-		}
+static struct EntryInval *inval_queue; // Oldest first
+static struct EntryInval **inval_tail = &inval_queue;
+static pthread_mutex_t inval_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the queue and inval_stop
+static pthread_cond_t inval_wake = PTHREAD_COND_INITIALIZER;
+static int inval_stop;
+static pthread_t inval_thread;
+
+/** invalAttr
+ * Drops the kernel's cached attributes of a node after a reply changed them.
+ * Pages stay cached, and with no offset the kernel takes no inode lock, so
+ * this is safe from inside a request
+ **/
+static void invalAttr(fuse_ino_t ino)
+{
+	if (ll_chan != NULL)
+	{
+		fuse_lowlevel_notify_inval_inode(ll_chan, ino, -1, 0);
+	}
+}
 
-		// Getting the parent
-		p->size--;
-		parent = getInodePath(p, disk);
-		if(parent == NULL) {
-			printf("Error allocating parent in rmdir\n");
-			return -1;
-		}
+/** invalEntry
+ * Queues name in parent to be dropped from the kernel's dentry cache. The
+ * kernel locks the parent to do it, which another request can hold while it
+ * waits on us, so the notifier thread sends it instead of the request
+ **/
+static void invalEntry(fuse_ino_t parent, const char *name)
+{
+	struct EntryInval *inval;
 
-		// Check if it is a dir
-		if( (my_inode->mode & S_IFDIR) == 0) {
-			printf("Error cant rmdir on a non-dir\n");
-			return -1;
-		}
+	if (ll_chan == NULL || (inval = malloc(sizeof(struct EntryInval))) == NULL)
+	{ // The entry times out instead
+		return;
+	}
+	inval->parent = parent;
+	snprintf(inval->name, sizeof(inval->name), "%s", name);
+	inval->next = NULL;
+	pthread_mutex_lock(&inval_lock);
+	*inval_tail = inval;
+	inval_tail = &inval->next;
+	pthread_cond_signal(&inval_wake);
+	pthread_mutex_unlock(&inval_lock);
+}
 
-		// Check if its empty
-		if(my_inode->size != 0) {
-			printf("Error, dir not empty\n");
-			return -1;
-		}
+static void *invalNotifier(void *arg)
+{
+	struct EntryInval *inval;
 
-		// Getting the directory entry in the parent
-		struct wfs_dentry* my_dirent;
-		my_dirent = searchDir(parent, dir_name,disk);
-		if(my_dirent == NULL) {
-			printf("Entry not found in rmdir\n");
-			return -1;
+	pthread_mutex_lock(&inval_lock);
+	while (!inval_stop)
+	{
+		if (inval_queue == NULL)
+		{
+			pthread_cond_wait(&inval_wake, &inval_lock);
+			continue;
 		}
-
-		int block;
-		
-		// Free the entry in the parent dir
-		memset(my_dirent,0, sizeof(struct wfs_dentry));	
-		parent->size-=sizeof(struct wfs_dentry);	
-		for(int i =0; i < N_BLOCKS;i++) {
-			if(my_inode->blocks[i] != -1) {
-				block = my_inode->blocks[i] / BLOCK_SIZE;
-				markbitmap_d(block, 0, disk);
-			}
+		inval = inval_queue;
+		inval_queue = inval->next;
+		if (inval_queue == NULL)
+		{
+			inval_tail = &inval_queue;
 		}
+		pthread_mutex_unlock(&inval_lock);
+		fuse_lowlevel_notify_inval_entry(ll_chan, inval->parent, inval->name, strlen(inval->name));
+		free(inval);
+		pthread_mutex_lock(&inval_lock);
+	}
+	pthread_mutex_unlock(&inval_lock);
+	return NULL;
+}
 
-		markbitmap_i(my_inode->num, 0, disk); // Freeing inode
-		wfs_unlink(path); // Removing it in parent?
+/** startNotifier
+ * Starts sending notifications on ch. Without the thread nothing is sent and
+ * the kernel's caches only time out
+ **/
+static void startNotifier(struct fuse_chan *ch)
+{
+	inval_stop = 0;
+	ll_chan = ch;
+	if (pthread_create(&inval_thread, NULL, invalNotifier, NULL) != 0)
+	{
+		LOG_WARN("Couldn't start the notifier, kernel caches will only time out\n");
+		ll_chan = NULL;
 	}
-	return 0;
 }
 
-static int readdir0(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+// Stops notifications before the channel goes away, unsent ones are dropped
+static void stopNotifier()
 {
-	printf("=-----------WFS_READDIR0()---------\n");
-	char *pathcpy = strdup(path);
-	Path *p = splitPath(pathcpy);
-	if (p == NULL)
+	struct EntryInval *inval;
+
+	if (ll_chan == NULL)
 	{
-		printf("wfs_readdir(): path is null\n");
+		return;
 	}
-	//TODO; FIx getInodePath
-	struct wfs_inode *directory = getInodePath(p, 0);
-	if (directory == NULL)
+	pthread_mutex_lock(&inval_lock);
+	inval_stop = 1;
+	pthread_cond_signal(&inval_wake);
+	pthread_mutex_unlock(&inval_lock);
+	pthread_join(inval_thread, NULL);
+	ll_chan = NULL;
+	while ((inval = inval_queue) != NULL)
 	{
-		return -ENOENT;
+		inval_queue = inval->next;
+		free(inval);
 	}
+	inval_tail = &inval_queue;
+}
+
+/** makeNode
+ * Creates name in directory parent, on every mirror for RAID 1 and once on
+ * disk 0 with the inode tables mirrored for RAID 0, like wfs_mknod. Returns
+ * the new inode or NULL with the error in *err
+ **/
+static struct wfs_inode *makeNode(int parent_num, const char *name, mode_t mode, int *err)
+{
+	struct wfs_inode *parent;
+	struct wfs_inode *child = NULL;
 
-	if ((directory->mode && S_IFDIR) == 0)
+	if (strlen(name) > MAX_NAME)
 	{
-		return -EBADF;
+		*err = ENAMETOOLONG;
+		return NULL;
 	}
-
-	off_t next_offset = 0;
-	struct wfs_dentry *direntry;
-	int disk = 0;
-	off_t filler_offset = 0;
-	
-	// return 0 if empty directory or if no more direntries
-	while (1)
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
 	{
-		direntry = findNextDir0(directory, offset, &next_offset,disk );
-		filler_offset += sizeof(struct wfs_dentry);
-		
-		//if the directry on this disk is empty
-		if (direntry == NULL)
+		parent = getInode(parent_num, disk);
+		if (parent == NULL || !S_ISDIR(parent->mode))
 		{
-			disk++;
-			// if it is the end of the disk then exit
-			if(disk >= numdisks){
-				return 0;
-			}
-			continue;
+			*err = ENOTDIR;
+			return NULL;
 		}
-
-
-		printf("readdir0(): disk: %d direntry->name: %s num: %d\n, next_offset: %ld filler_offset: %ld\n", 
-									disk, direntry->name, direntry->num, next_offset, filler_offset);
-
-		
-		if (filler(buf, direntry->name, NULL, 0) != 0)
+		if (lookupChild(parent, name, disk) != NULL)
 		{
-			printf("wfs_readdir(): filler returned nonzero\n");
-			return 0;
+			*err = EEXIST;
+			return NULL;
 		}
 
-		// if at the end of the dir for this disk
-		if (next_offset == 0)
+		child = allocateInode(disk);
+		if (child == NULL)
 		{
-			disk++;
-			if(disk == numdisks){
-				return 0;
-			}
+			*err = ENOSPC;
+			return NULL;
+		}
+		child->mode |= mode;
+		if (S_ISDIR(mode))
+		{
+			initDirFormat(child);
+		}
+		else if (S_ISREG(mode))
+		{
+			initInodeFormat(child);
+		}
+		if (linkdir(parent, child, (char *)name, disk) == -1)
+		{ // The parent directory is full
+			markbitmap_i(child->num, 0, disk);
+			*err = ENOSPC;
+			return NULL;
 		}
-
-		offset = next_offset;
-	}
-
-	printf("wfs_readdir(): failed somehow\n");
-	return 0;
-}
-// Return one or more directory entries (struct dirent) to the caller
-// It is related to, but not identical to, the readdir(2) and getdents(2) system calls, and the readdir(3) library function. Because of its complexity, it is described separately below. Required for essentially any filesystem,
-//  since it's what makes ls and a whole bunch of other things work.
-// It's also important to note that readdir can return errors in a number of instances; in particular it can return -EBADF if the file handle is invalid, or -ENOENT if you use the path argument and the path doesn't exist.
-
-// We shall let offset = the offset from the  d_blocks_ptr to the first dentry
-// if offset == 0 then we search for the first dentry and set the offset to the next dentry
-static int readdir1(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
-{
-	printf("WFS_READDIR()---------\n");
-	char *pathcpy = strdup(path);
-	Path *p = splitPath(pathcpy);
-	if (p == NULL)
-	{
-		printf("wfs_readdir(): path is null\n");
 	}
-	struct wfs_inode *directory = getInodePath(p, 0);
-	if (directory == NULL)
+	if (raid_mode == 0)
 	{
-		return -ENOENT;
+		mirrorInodeTables();
 	}
+	return getInode(child->num, 0);
+}
 
-	if ((directory->mode && S_IFDIR) == 0)
-	{
-		return -EBADF;
-	}
+/** removeNode
+ * Removes name from directory parent, an empty directory when dir is set and
+ * anything else otherwise. Open files are only freed by their last release
+ **/
+static int removeNode(int parent_num, const char *name, int dir)
+{
+	struct wfs_inode *parent;
+	struct wfs_inode *child;
+	int pinned = 0;
 
-	off_t next_offset = 0;
-	struct wfs_dentry *direntry;
-	int original_offset = offset;
-	while (1)
+	for (int disk = 0; disk < (raid_mode == 1 ? numdisks : 1); disk++)
 	{
-		
-		direntry = findNextDir1(directory, offset, &next_offset);
-
-		if (direntry == NULL)
+		parent = getInode(parent_num, disk);
+		if (parent == NULL || !S_ISDIR(parent->mode))
 		{
-			printf("empty dir\n");
-			return 0;
+			return -ENOTDIR;
 		}
-		printf("readdir(): direntry->name: %s num: %d\n, next_offset: %ld\n", direntry->name, direntry->num, next_offset);
-		if (filler(buf, direntry->name, NULL, next_offset) != 0)
+		child = lookupChild(parent, name, disk);
+		if (child == NULL)
 		{
-			printf("wfs_readdir(): filler returned nonzero\n");
-			return 0;
+			return -ENOENT;
+		}
+		if (dir != (S_ISDIR(child->mode) != 0))
+		{
+			return dir ? -ENOTDIR : -EISDIR;
+		}
+		if (dir && child->size != 0)
+		{
+			return -ENOTEMPTY;
+		}
+		if (disk == 0)
+		{
+			pthread_mutex_lock(&open_lock);
+			pinned = open_counts[child->num] > 0;
+			pthread_mutex_unlock(&open_lock);
 		}
 
-		if (next_offset == 0)
+		if (deleteDentry(parent, (char *)name, disk) != 0)
 		{
-			if(original_offset > 0){
-				offset = 0;
-				printf("original offset > 0\n");
-				continue;
-			}
-			printf("wfs_readir(): no more files\n");
-			return 0;
+			return -EIO;
+		}
+		if (dir)
+		{
+			dcachePurgeDir(child->num, disk);
+			freeDirBlocks(child, disk);
+			markbitmap_i(child->num, 0, disk);
+			continue;
+		}
+		child->nlinks--;
+		markInodeDirty(child);
+		if (child->nlinks == 0 && !pinned)
+		{
+			freeInode(child, disk);
 		}
-		offset = next_offset;
 	}
-	printf("wfs_readdir(): failed somehow\n");
-	return -1;
+	if (raid_mode == 0)
+	{
+		mirrorInodeTables();
+	}
+	return 0;
 }
 
-static int wfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
-	if(raid_mode == 1){
-		return readdir1(path, buf, filler,  offset, fi);
-	} else if (raid_mode == 0){
-		return readdir0(path, buf, filler, offset, fi);
-	}
-	return -1;
+static void ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	wfs_init(conn);
 }
-static int read1(const char* path, char* buf, size_t size, off_t offset) {
-	int bytes_read = 0;
 
-	// Getting path components
-	char* malleable_path = strdup(path);
-	if(malleable_path == NULL) {
-		printf("Couldn't get malleable path in read\n");
-		return -1;
-	}
-	
-	Path* p = splitPath(malleable_path);
-	if(p == NULL) {
-		printf("Couldn't get path struct in read\n");
-		return -1;
-	}
+static void ll_destroy(void *userdata)
+{
+	wfs_destroy(userdata);
+}
 
-	struct wfs_inode* my_inode = getInodePath(p, 0);
-	if(my_inode == NULL) {
-		printf("Couldnt get inode of file to read\n");
-		return -1;
-	}
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct wfs_inode *dir;
+	struct fuse_entry_param e;
+	uint64_t start = statStart();
 
-	// Check if offset too far out
-	if(offset >= my_inode->size) {
-		printf("Inode size is %ld\n", my_inode->size);
-		return 0;
+	if (parent == FUSE_ROOT_ID && strcmp(name, STATS_NAME) == 0)
+	{
+		fillEntry(NULL, &e);
+		e.ino = statsNode();
+		statsStat(&e.attr, e.ino);
+		fuse_reply_entry(req, &e);
+		return;
 	}
-
-	int data_index;
-	unsigned char* data_ptr; // Points to the byte of data to be read
-
-	//INDIRECT EXTENSION
-	int indirect_block_index = -1;
-	struct IndirectBlock * indirblock = NULL;
-
-	data_index = offset / BLOCK_SIZE; // Going into the block which has this data
-	if(data_index >= IND_BLOCK){
-		indirect_block_index = data_index - D_BLOCK;
-		indirblock =(struct IndirectBlock *)( mappings[0] + superblocks[0]->d_blocks_ptr + my_inode->blocks[IND_BLOCK]);
-		data_ptr = mappings[0] + superblocks[0]->d_blocks_ptr + indirblock->blocks[indirect_block_index];
-	} else {
-		data_ptr = mappings[0] + superblocks[0]->d_blocks_ptr + my_inode->blocks[data_index] + (offset%BLOCK_SIZE);
-	}
-
-	int remaining = BLOCK_SIZE - (offset % BLOCK_SIZE);
-	int offsetcpy = offset;
-	while(bytes_read < size && offsetcpy < my_inode->size) {
-		// Write up to end of block
-		if(remaining > 0) {
-			memcpy(buf + bytes_read, data_ptr, 1);
-			bytes_read++;
-			remaining--;
-			data_ptr++;
-			offsetcpy++;
-
-		}
-		else if(remaining == 0) {
-			data_index++;
-			if(data_index >= IND_BLOCK){
-				indirect_block_index++;
-				indirblock =(struct IndirectBlock *)( mappings[0] + superblocks[0]->d_blocks_ptr + my_inode->blocks[IND_BLOCK]);
-				data_ptr = mappings[0] + superblocks[0]->d_blocks_ptr + indirblock->blocks[indirect_block_index];
-			} else {
-				data_ptr = mappings[0] + superblocks[0]->d_blocks_ptr + my_inode->blocks[data_index];
-			}
-			remaining = BLOCK_SIZE;
-		}
-		else {
-			printf("Its cooked\n");
-			return -1;
-		}
+	pthread_rwlock_rdlock(&tree_lock);
+	dir = nodeInode(parent);
+	if (dir == NULL || !S_ISDIR(dir->mode))
+	{
+		pthread_rwlock_unlock(&tree_lock);
+		fuse_reply_err(req, ENOTDIR);
+		return;
 	}
+	fillEntry(lookupChild(dir, name, 0), &e);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_LOOKUP, start, 0);
+	fuse_reply_entry(req, &e);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct wfs_inode *inode;
+	struct stat st;
+	uint64_t start = statStart();
 
-	if(*data_ptr == 0) {
-		printf("Exit because of null\n");
+	if (ino == statsNode())
+	{
+		statsStat(&st, ino);
+		fuse_reply_attr(req, &st, 0);
+		return;
 	}
-	else {
-		printf("Exit because of eof\n");
+	pthread_rwlock_rdlock(&tree_lock);
+	inode = nodeInode(ino);
+	if (inode != NULL)
+	{
+		fillStat(inode, &st);
+		st.st_ino = ino;
 	}
-
-	for(int i =0;i < p->size;i++) {
-		free(p->path_components[i]);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_GETATTR, start, 0);
+	if (inode == NULL)
+	{
+		fuse_reply_err(req, ENOENT);
+		return;
 	}
-	free(p);
-	return bytes_read;
+	fuse_reply_attr(req, &st, cache_timeout);
 }
 
-static int read0(const char* path, char* buf, size_t size, off_t offset) {
-	int bytes_read = 0;
-	int disk = 0;
-	// Getting path components
-	char* malleable_path = strdup(path);
-	if(malleable_path == NULL) {
-		printf("Couldn't get malleable path in read\n");
-		return -1;
+// Replies to mknod, mkdir and create
+static void replyNode(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+	struct wfs_inode *inode;
+	struct fuse_entry_param e;
+	int err = 0;
+	uint64_t start = statStart();
+
+	if (parent == FUSE_ROOT_ID && strcmp(name, STATS_NAME) == 0)
+	{
+		fuse_reply_err(req, EEXIST);
+		return;
 	}
-	
-	Path* p = splitPath(malleable_path);
-	if(p == NULL) {
-		printf("Couldn't get path struct in read\n");
-		return -1;
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	inode = makeNode(parent - FUSE_ROOT_ID, name, mode, &err);
+	if (inode == NULL)
+	{
+		journalOpEnd();
 	}
-
-	struct wfs_inode* my_inode = getInodePath(p, disk);
-	if(my_inode == NULL) {
-		printf("Couldnt get inode of file to read\n");
-		return -1;
+	else
+	{
+		fillEntry(inode, &e);
+		if (syncOp(-1) != 0)
+		{
+			err = EIO;
+		}
+		else if (fi != NULL)
+		{
+			err = -openInode(inode->num, fi);
+		}
 	}
-
-	// Check if offset too far out
-	if(offset >= my_inode->size) {
-		printf("Inode size is %ld\n", my_inode->size);
-		return 0;
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(fi != NULL ? STAT_CREATE : S_ISDIR(mode) ? STAT_MKDIR : STAT_MKNOD, start, 0);
+	if (err != 0)
+	{
+		fuse_reply_err(req, err);
+	}
+	else if (fi != NULL)
+	{
+		fuse_reply_create(req, &e, fi);
+	}
+	else
+	{
+		fuse_reply_entry(req, &e);
 	}
+	if (err == 0)
+	{ // The parent's size and times changed
+		invalAttr(parent);
+	}
+}
 
-	int data_index;
-	unsigned char* data_ptr; // Points to the byte of data to be read
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+	replyNode(req, parent, name, mode, NULL);
+}
 
-	//INDIRECT EXTENSION
-	int indirect_block_index = -1;
-	struct IndirectBlock * indirblock = NULL;
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	replyNode(req, parent, name, mode | S_IFDIR, NULL);
+}
 
-	data_index = offset / BLOCK_SIZE; // Going into the block which has this data
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
+{
+	replyNode(req, parent, name, mode, fi);
+}
 
-	// !TODO HANDLE INDIRECT
-	if(data_index >= IND_BLOCK){
-		indirect_block_index = data_index - D_BLOCK;
-		indirblock =(struct IndirectBlock *)( mappings[disk] + superblocks[disk]->d_blocks_ptr + my_inode->blocks[IND_BLOCK]);
-		data_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + indirblock->blocks[indirect_block_index];
-	} else {
+static void replyRemove(fuse_req_t req, fuse_ino_t parent, const char *name, int dir)
+{
+	int ret_val;
+	uint64_t start = statStart();
 
-		// Getting entry at disk and offset
-		disk = getEntryDisk(my_inode->blocks[data_index]);
-		data_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(my_inode->blocks[data_index]) + (offset%BLOCK_SIZE);
+	if (parent == FUSE_ROOT_ID && strcmp(name, STATS_NAME) == 0)
+	{
+		fuse_reply_err(req, dir ? ENOTDIR : EACCES);
+		return;
+	}
+	pthread_rwlock_wrlock(&tree_lock);
+	journalOpBegin();
+	ret_val = removeNode(parent - FUSE_ROOT_ID, name, dir);
+	if (ret_val == 0)
+	{
+		ret_val = syncOp(-1);
+	}
+	else
+	{
+		journalOpEnd();
 	}
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(dir ? STAT_RMDIR : STAT_UNLINK, start, 0);
+	fuse_reply_err(req, -ret_val);
+	if (ret_val == 0)
+	{
+		invalAttr(parent);
+		invalEntry(parent, name);
+	}
+}
 
-	int remaining = BLOCK_SIZE - (offset % BLOCK_SIZE);
-	int offsetcpy = offset;
-	while(bytes_read < size && offsetcpy < my_inode->size) {
-		// Write up to end of block
-		if(remaining > 0) {
-			memcpy(buf + bytes_read, data_ptr, 1);
-			bytes_read++;
-			remaining--;
-			data_ptr++;
-			offsetcpy++;
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	replyRemove(req, parent, name, 0);
+}
 
-		}
-		else if(remaining == 0) {
-			data_index++;
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	replyRemove(req, parent, name, 1);
+}
 
-			// !TODO HANDLE INDIRECT
-			if(data_index >= IND_BLOCK){
-				indirect_block_index++;
-				indirblock =(struct IndirectBlock *)( mappings[disk] + superblocks[disk]->d_blocks_ptr + my_inode->blocks[IND_BLOCK]);
-				data_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + indirblock->blocks[indirect_block_index];
-			} else {
-				disk = getEntryDisk(my_inode->blocks[data_index]);
-				data_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(my_inode->blocks[data_index]);
-			}
-			remaining = BLOCK_SIZE;
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int ret_val;
+	uint64_t start = statStart();
+
+	if (ino == statsNode())
+	{
+		if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		{
+			fuse_reply_err(req, EACCES);
+			return;
 		}
-		else {
-			printf("Its cooked\n");
-			return -1;
+		fi->fh = (uintptr_t)openStats();
+		fi->direct_io = 1;
+		if (fi->fh == 0)
+		{
+			fuse_reply_err(req, ENOMEM);
+			return;
 		}
+		fuse_reply_open(req, fi);
+		return;
 	}
-
-	if(*data_ptr == 0) {
-		printf("Exit because of null\n");
-	}
-	else {
-		printf("Exit because of eof\n");
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = nodeInode(ino) == NULL ? -ENOENT : openInode(ino - FUSE_ROOT_ID, fi);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_OPEN, start, 0);
+	if (ret_val != 0)
+	{
+		fuse_reply_err(req, -ret_val);
+		return;
 	}
-	return bytes_read;	
+	fuse_reply_open(req, fi);
 }
 
-static int wfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-	printf("wfs_read\n");
-	if(raid_mode == 1 ) {
-		return read1(path, buf, size, offset);
+	if (ino == statsNode())
+	{
+		closeStats((struct StatsSnapshot *)(uintptr_t)fi->fh);
 	}
-	else if(raid_mode == 0) {
-		return read0(path, buf, size, offset);
+	else
+	{
+		wfs_release(NULL, fi);
 	}
-	return -1;
+	fuse_reply_err(req, 0);
 }
-static int write_raid0(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
-	int written_bytes = 0;
-	int disk =0;
-	Path* p;
-	char* malleable_path;
-	struct wfs_inode* my_file;
-	off_t curr_block_offset;
-	unsigned char *curr_block_ptr;
-	int remaining_space;
-	int curr_block_index;
 
-	malleable_path = strdup(path);
-	if (malleable_path == NULL)
-	{
-		printf("Couldnt create malleable_path\n");
-		return -1;
-	}
+// The reply is spliced straight out of the images like wfs_read_buf
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct wfs_inode *file;
+	struct fuse_bufvec *bufv = NULL;
+	int ret_val;
+	uint64_t start = statStart();
+	char *text;
 
-	p = splitPath(malleable_path);
-	if (p == NULL)
+	if (ino == statsNode())
 	{
-		printf("Couldnt split path\n");
-		return -1;
+		text = malloc(size);
+		if (text == NULL)
+		{
+			fuse_reply_err(req, ENOMEM);
+			return;
+		}
+		fuse_reply_buf(req, text, readStats((struct StatsSnapshot *)(uintptr_t)fi->fh, text, size, off));
+		free(text);
+		return;
 	}
-
-	my_file = getInodePath(p, disk);
-	printf("my_file->num: %d\n", my_file->num);
-	if (my_file == NULL)
+	pthread_rwlock_rdlock(&tree_lock);
+	file = nodeInode(ino);
+	ret_val = file == NULL ? -ENOENT : readFileBufs(file, getHandle(fi), &bufv, size, off);
+	pthread_rwlock_unlock(&tree_lock);
+	if (ret_val < 0)
 	{
-		printf("File does not exist\n");
-		return -ENOENT;
+		fuse_reply_err(req, -ret_val);
+		return;
 	}
-
-	curr_block_index = offset / 512;
-	curr_block_offset = my_file->blocks[curr_block_index];
-	if(curr_block_offset == -1) {
-		printf("No block found for write, we are going to grow the file\n");
-		disk = getNextDisk();
-		printf("Allocated disk is %d\n", disk);
-		my_file->blocks[curr_block_index] = allocateBlock(disk);
-		if(my_file->blocks[curr_block_index] == -1) {
-			printf("No space to write\n");
-			return -ENOSPC;
+	statEnd(STAT_READ, start, fuse_buf_size(bufv));
+	fuse_reply_data(req, bufv, 0);
+	for (size_t i = 0; i < bufv->count; i++)
+	{
+		if (!(bufv->buf[i].flags & FUSE_BUF_IS_FD))
+		{ // Holes, inline data and striped copies
+			free(bufv->buf[i].mem);
 		}
-		curr_block_offset = my_file->blocks[curr_block_index];
 	}
-	
-	curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(curr_block_offset); 
-	disk = getEntryDisk(curr_block_offset);
-	remaining_space = BLOCK_SIZE -  (offset % BLOCK_SIZE);
-	while(written_bytes != size) {
-		printf("Loop\n");
-		if(curr_block_offset == -1){
-			disk = getNextDisk();
-			printf("in while\n");
-			printf("Allocated disk is %d\n", disk);
-			my_file->blocks[curr_block_index] = allocateBlock(disk);
-			curr_block_offset = my_file->blocks[curr_block_index];
-			if (curr_block_offset == -1) { // If still not allocated then exit on error of no space
-				return -ENOSPC;
-			}
-			curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(curr_block_offset);
-		}
+	free(bufv);
+}
 
+static void ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
+{
+	struct wfs_inode *file;
+	int ret_val;
+	uint64_t start = statStart();
+
+	pthread_rwlock_rdlock(&tree_lock);
+	file = nodeInode(ino);
+	ret_val = file == NULL ? -ENOENT : writeInode(file, bufv, off);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_WRITE, start, ret_val);
+	if (ret_val < 0)
+	{
+		fuse_reply_err(req, -ret_val);
+		return;
+	}
+	fuse_reply_write(req, ret_val);
+	invalAttr(ino); // Size, times and blocks, the written pages are already in the kernel's cache
+}
 
-		if (size - written_bytes >= remaining_space) {
-			printf("writing entire block, going to next blockn\n");
-			memcpy(curr_block_ptr, buf + written_bytes, remaining_space); // Fill rest of block
-			written_bytes += remaining_space;							  // Update how many bytes we have written
-			curr_block_index++;
-			curr_block_offset = my_file->blocks[curr_block_index];
-			if(curr_block_offset != -1) {
-				curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + getEntryOffset(curr_block_offset);
-			}		
-			remaining_space = BLOCK_SIZE;
-		}
+// fsync, fsyncdir and flush, with the same durability rules as wfs_fsync and wfs_flush
+static void replySync(fuse_req_t req, fuse_ino_t ino, int wait)
+{
+	int ret_val = 0;
+	uint64_t start = statStart();
 
-		// Write is less than remaining space in block
-		else if ((size - written_bytes) < remaining_space)
-		{
-			printf("writing partial block\n");
-			memcpy(curr_block_ptr, buf + written_bytes, size - written_bytes); // just write the bytes
-			written_bytes += (size - written_bytes);
-		}
-		else
-		{
-			printf("Error you cant write more ... you shouldn't be here\n");
-			return -1;
-		}	
-		
+	if ((wait ? durability == DURABLE_NONE : durability != DURABLE_FSYNC) || ino == statsNode())
+	{
+		fuse_reply_err(req, 0);
+		return;
 	}
-	my_file->size += written_bytes;	
-	printf("Wrote %d bytes\n", written_bytes);
-	return written_bytes;
+	pthread_rwlock_rdlock(&tree_lock);
+	ret_val = nodeInode(ino) == NULL ? -ENOENT : fsyncInode(ino - FUSE_ROOT_ID, wait);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(wait ? STAT_FSYNC : STAT_FLUSH, start, 0);
+	fuse_reply_err(req, -ret_val);
 }
 
-
-static int write_raid1(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
-	
-	int written_bytes = 0;
-	for(int disk =0; disk < numdisks;disk++) {
-		
-		written_bytes = 0;
-		Path* p;
-		char* malleable_path;
-		struct wfs_inode* my_file;
-		off_t curr_block_offset;
-		unsigned char *curr_block_ptr;
-		int remaining_space;
-		int curr_block_index;
-
-		malleable_path = strdup(path);
-		if (malleable_path == NULL)
-		{
-			printf("Couldnt create malleable_path\n");
-			return -1;
-		}
+	replySync(req, ino, 1);
+}
 
-		p = splitPath(malleable_path);
-		if (p == NULL)
-		{
-			printf("Couldnt split path\n");
-			return -1;
-		}
+static void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	replySync(req, ino, 0);
+}
 
-		my_file = getInodePath(p, disk);
-		printf("my_file->num: %d\n", my_file->num);
-		if (my_file == NULL)
+// readdirInode filler that packs entries the way the kernel reads them
+static int fillListing(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+	struct DirListing *list = buf;
+	struct stat st = *stbuf;
+	size_t len;
+	char *grown;
+
+	st.st_ino += FUSE_ROOT_ID;
+	len = fuse_add_direntry(list->req, NULL, 0, name, NULL, 0);
+	if (list->size + len > list->cap)
+	{
+		grown = realloc(list->buf, MAX(list->cap * 2, list->size + len));
+		if (grown == NULL)
 		{
-			printf("File does not exist\n");
-			return -ENOENT;
+			return 1;
 		}
+		list->buf = grown;
+		list->cap = MAX(list->cap * 2, list->size + len);
+	}
+	fuse_add_direntry(list->req, list->buf + list->size, len, name, &st, list->size + len);
+	list->size += len;
+	return 0;
+}
 
-		// indirect block stuff
-		int indirect_block_index = -1;
-		struct IndirectBlock * idirblock =(struct IndirectBlock *)( mappings[disk] +
-			 superblocks[disk]->d_blocks_ptr + my_file->blocks[IND_BLOCK]); 
-
-		curr_block_index = offset / BLOCK_SIZE;
-
-		if(curr_block_index >= IND_BLOCK){
-			indirect_block_index = curr_block_index - IND_BLOCK;
-			curr_block_offset = idirblock->blocks[indirect_block_index]; 
-
-		} else {
-			curr_block_offset = my_file->blocks[curr_block_index];
-		}
-
-		if (curr_block_offset == -1)
-		{															 // If block not allocated
-			//CHECK IF AN INDIRECT BLOCK
-			if(curr_block_index == IND_BLOCK){
-				//allocate indirect block 
-				my_file->blocks[curr_block_index] = initializeIndirectBlock( disk);	
-
-				idirblock->blocks[0] = allocateBlock(disk);
-				curr_block_offset = idirblock->blocks[0];
-				indirect_block_index = 0;
-
-			} else if (indirect_block_index >= 0){
-				//allocate block in indirect block
-				idirblock->blocks[indirect_block_index] = allocateBlock(disk);
-				curr_block_offset = idirblock->blocks[indirect_block_index];
-			} else  {
-				my_file->blocks[curr_block_index] = allocateBlock(disk); // try to allocate it
-				curr_block_offset = my_file->blocks[curr_block_index];
-			}
-				if (curr_block_offset== -1)
-				{ // If still not allocated then exit on error of no space
-					printf("Cant allocate more file for write\n");
-					return -ENOSPC;
-				}			
-		}
+/** ll_opendir
+ * Packs the whole listing once, readdir hands it out in the pieces the kernel
+ * asks for. The entries carry their inode and type, what 2.9 can give in
+ * place of readdirplus
+ **/
+static void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct wfs_inode *dir;
+	struct DirListing *list;
+	int ret_val;
+	uint64_t start = statStart();
 
-		curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + curr_block_offset + (offset%512);
-		remaining_space = 512-(offset % 512);
-		while(written_bytes != size) {
+	list = calloc(1, sizeof(struct DirListing));
+	if (list == NULL)
+	{
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	list->req = req;
+	pthread_rwlock_rdlock(&tree_lock);
+	dir = nodeInode(ino);
+	ret_val = dir == NULL ? -ENOENT : readdirInode(dir, list, fillListing);
+	pthread_rwlock_unlock(&tree_lock);
+	statEnd(STAT_READDIR, start, 0);
+	if (ret_val != 0)
+	{
+		free(list->buf);
+		free(list);
+		fuse_reply_err(req, ret_val == -EBADF ? ENOTDIR : -ret_val);
+		return;
+	}
+	fi->fh = (uintptr_t)list;
+	fuse_reply_open(req, fi);
+}
 
-			// INDIRECT MOD
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct DirListing *list = (struct DirListing *)(uintptr_t)fi->fh;
 
-			// Ensuring block is allocated
-			if (curr_block_offset == -1)
-			{
-				if(curr_block_index == IND_BLOCK){
-					my_file->blocks[curr_block_index] = initializeIndirectBlock( disk);	
-					idirblock = (struct IndirectBlock *)(mappings[disk]
-					 + superblocks[disk]->d_blocks_ptr + my_file->blocks[curr_block_index]);
-
-					idirblock->blocks[0] = allocateBlock(disk);
-					curr_block_offset = idirblock->blocks[0];
-					indirect_block_index = 0;
-
-				} else if (indirect_block_index >= 0){
-					idirblock->blocks[indirect_block_index] = allocateBlock(disk);	
-					curr_block_offset = idirblock->blocks[indirect_block_index];
-				} else {
-					my_file->blocks[curr_block_index] = allocateBlock(disk);
-					curr_block_offset = my_file->blocks[curr_block_index];
-				}
+	if (off >= (off_t)list->size)
+	{
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	fuse_reply_buf(req, list->buf + off, MIN(list->size - off, size));
+}
 
-				if (curr_block_offset == -1)
-				{ // If still not allocated then exit on error of no space
-					return -ENOSPC;
-				}
-				curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + curr_block_offset;
-			}
+static void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct DirListing *list = (struct DirListing *)(uintptr_t)fi->fh;
 
+	free(list->buf);
+	free(list);
+	fuse_reply_err(req, 0);
+}
 
-			// Check if we need to write larger than block space
-			if (size - written_bytes >= remaining_space)
-			{
-				memcpy(curr_block_ptr, buf + written_bytes, remaining_space); // Fill rest of block
-				written_bytes += remaining_space;							  // Update how many bytes we have written
-
-				// Go to next block
-				if(indirect_block_index >= 0){
-					indirect_block_index++;
-					curr_block_offset = idirblock->blocks[indirect_block_index];
-					curr_block_index++;
-				} else {
-					curr_block_index++;
-					curr_block_offset = my_file->blocks[curr_block_index];
-				}
-				curr_block_ptr = mappings[disk] + superblocks[disk]->d_blocks_ptr + curr_block_offset;
-				remaining_space = BLOCK_SIZE;
-			}
+static void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	replySync(req, ino, 1);
+}
 
+static struct fuse_lowlevel_ops ll_ops = {
+	.init = ll_init,
+	.destroy = ll_destroy,
+	.lookup = ll_lookup,
+	.getattr = ll_getattr,
+	.mknod = ll_mknod,
+	.mkdir = ll_mkdir,
+	.create = ll_create,
+	.unlink = ll_unlink,
+	.rmdir = ll_rmdir,
+	.open = ll_open,
+	.release = ll_release,
+	.read = ll_read,
+	.write_buf = ll_write_buf,
+	.flush = ll_flush,
+	.fsync = ll_fsync,
+	.opendir = ll_opendir,
+	.readdir = ll_readdir,
+	.releasedir = ll_releasedir,
+	.fsyncdir = ll_fsyncdir,
+};
 
-			// Write is less than remaining space in block
-			else if (size - written_bytes < remaining_space)
-			{
-				memcpy(curr_block_ptr, buf + written_bytes, size - written_bytes); // just write the bytes
-				written_bytes += (size - written_bytes);
+/** runLowLevel
+ * Mounts and serves ll_ops, what fuse_main does for the high-level ops
+ **/
+static int runLowLevel(struct fuse_args *args)
+{
+	struct fuse_chan *ch;
+	struct fuse_session *se;
+	char *mountpoint;
+	int multithreaded;
+	int foreground;
+	int err = -1;
+
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1)
+	{
+		LOG_ERROR("Couldn't parse the FUSE options\n");
+		return 1;
+	}
+	ch = fuse_mount(mountpoint, args);
+	if (ch == NULL)
+	{
+		LOG_ERROR("Couldn't mount %s\n", mountpoint);
+		free(mountpoint);
+		return 1;
+	}
+	se = fuse_lowlevel_new(args, &ll_ops, sizeof(ll_ops), NULL);
+	if (se != NULL)
+	{
+		if (fuse_set_signal_handlers(se) != -1)
+		{
+			fuse_session_add_chan(se, ch);
+			if (fuse_daemonize(foreground) != -1)
+			{ // Threads don't survive daemonizing
+				startNotifier(ch);
+				err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+				stopNotifier();
 			}
-			else
-			{
-				printf("Error you cant write more ... you shouldn't be here\n");
-				return -1;
-			}	
+			fuse_remove_signal_handlers(se);
+			fuse_session_remove_chan(ch);
 		}
-		my_file->size += written_bytes;	
-		for(int i =0;i<p->size;i++) {
-			free(p->path_components[i]);
-		}
-		free(p);
+		fuse_session_destroy(se);
 	}
-	
-	return written_bytes;
+	fuse_unmount(mountpoint, ch);
+	free(mountpoint);
+	return err ? 1 : 0;
 }
 
-static int wfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
-
-	if(raid_mode == 1){
-		printf("raid1\n");
-		return write_raid1(path, buf, size, offset, fi);
-	}
-	else if(raid_mode == 0) {
-		return write_raid0(path, buf, size, offset, fi);
-	}
-	return -1;
-
-}
-static int wfs_getattr(const char *path, struct stat *stbuf)
+/** parseOptions
+ * Applies the mount options collected by fuse_opt_parse
+ **/
+static int parseOptions()
 {
-	printf("wfs_getattr\n");
-	printf("Path is %s\n", path);
-	Path *p;
-	struct wfs_inode *my_inode;
-	char *malleable_path;
-	malleable_path = strdup(path);
-
-	if (malleable_path == NULL)
+	if (options.read_policy != NULL)
 	{
-		return -1;
+		if (strcmp(options.read_policy, "primary") == 0)
+		{
+			read_policy = READ_PRIMARY;
+		}
+		else if (strcmp(options.read_policy, "rr") == 0)
+		{
+			read_policy = READ_ROUND_ROBIN;
+		}
+		else if (strcmp(options.read_policy, "stripe") == 0)
+		{
+			read_policy = READ_STRIPE;
+		}
+		else
+		{
+			LOG_ERROR("Unknown read_policy %s, expected primary, rr or stripe\n", options.read_policy);
+			return -1;
+		}
 	}
-	p = splitPath(malleable_path);
-	if(p== NULL) {
-		return -1;
+	if (options.durability != NULL)
+	{
+		if (strcmp(options.durability, "none") == 0)
+		{
+			durability = DURABLE_NONE;
+		}
+		else if (strcmp(options.durability, "fsync") == 0)
+		{
+			durability = DURABLE_FSYNC;
+		}
+		else if (strcmp(options.durability, "always") == 0)
+		{
+			durability = DURABLE_ALWAYS;
+		}
+		else
+		{
+			LOG_ERROR("Unknown durability %s, expected none, fsync or always\n", options.durability);
+			return -1;
+		}
 	}
-	
-	my_inode = getInodePath(p, 0);
-	if (my_inode == NULL)
+	if (options.data_advice != NULL)
 	{
-		return -ENOENT;
+		if (strcmp(options.data_advice, "normal") == 0)
+		{
+			data_advice = MADV_NORMAL;
+		}
+		else if (strcmp(options.data_advice, "sequential") == 0)
+		{
+			data_advice = MADV_SEQUENTIAL;
+		}
+		else if (strcmp(options.data_advice, "random") == 0)
+		{
+			data_advice = MADV_RANDOM;
+		}
+		else
+		{
+			LOG_ERROR("Unknown data_advice %s, expected normal, sequential or random\n", options.data_advice);
+			return -1;
+		}
 	}
-
-	stbuf->st_dev = 0;
-	stbuf->st_ino = my_inode->num;
-	stbuf->st_mode = my_inode->mode;
-	stbuf->st_nlink = my_inode->nlinks;
-	stbuf->st_uid = my_inode->uid;
-	stbuf->st_gid = my_inode->gid;
-	stbuf->st_rdev = 0;
-	stbuf->st_size = my_inode->size;
-	stbuf->st_blksize = BLOCK_SIZE;
-	stbuf->st_blocks = my_inode->size / BLOCK_SIZE;
-	printf("wfs_getattr done\n");
-
-	for(int i =0;i < p->size;i++) {
-		free(p->path_components[i]);
+	if (options.cache_timeout != NULL)
+	{
+		char *end;
+		cache_timeout = strtod(options.cache_timeout, &end);
+		if (end == options.cache_timeout || *end != '\0' || cache_timeout < 0)
+		{
+			LOG_ERROR("Invalid cache_timeout %s, expected seconds\n", options.cache_timeout);
+			return -1;
+		}
 	}
-	free(p);
-	free(malleable_path);
-	
 	return 0;
 }
 
-static struct fuse_operations ops = {
-	.getattr = wfs_getattr,
-	.mknod = wfs_mknod,
-	.mkdir = wfs_mkdir,
-	.unlink = wfs_unlink,
-	.rmdir = wfs_rmdir,
-	.read = wfs_read,
-	.write = wfs_write,
-	.readdir = wfs_readdir,
-	.destroy = wfs_destroy,
-};
-
-
 int main(int argc, char *argv[])
 {
 	// FOR VALGRIND
@@ -2155,6 +6812,10 @@ int main(int argc, char *argv[])
 
 	// TODO: INITIALIZE Raid_mode
 	mapDisks(argc, argv);
+	reclaimOrphans();
+#if WFS_TRACE
+	signal(SIGUSR1, traceSignal); // kill -USR1 dumps the trace ring
+#endif
 
 	new_argc = (argc - numdisks); // Gets difference of what was already read vs what isnt
 	char *new_argv[new_argc];
@@ -2166,15 +6827,45 @@ int main(int argc, char *argv[])
 
 	for (int i = 0; i < new_argc; i++)
 	{
-		printf("New arg [%d]: %s\n", i, new_argv[i]);
+		LOG_INFO("New arg [%d]: %s\n", i, new_argv[i]);
 	}
 
-	printf("Num disks %d\n", numdisks);
+	LOG_INFO("Num disks %d\n", numdisks);
 	for (int i = 0; i < numdisks; i++)
 	{
-		printf("Disk [%d]: %d\n", i, disk_size[i]);
+		LOG_INFO("Disk [%d]: %lld\n", i, (long long)disk_size[i]);
+	}
+
+	// Pull our own -o options out before handing the rest to FUSE
+	struct fuse_args args = FUSE_ARGS_INIT(new_argc, new_argv);
+	if (fuse_opt_parse(&args, &options, wfs_opts, NULL) == -1)
+	{
+		LOG_ERROR("Couldn't parse mount options\n");
+		return 1;
+	}
+	if (parseOptions() != 0)
+	{
+		return 1;
+	}
+	adviseDisks();
+	if (options.lowlevel)
+	{ // Its replies carry cache_timeout themselves
+		return runLowLevel(&args);
+	}
+
+	// Goes in front so attr_timeout, entry_timeout or negative_timeout given
+	// on the command line still win. hard_remove hands unlinks of open files
+	// to wfs_unlink, which keeps them for their handles, instead of FUSE
+	// hiding them with a rename wfs doesn't have
+	char timeouts[128];
+	snprintf(timeouts, sizeof(timeouts), "-ohard_remove,attr_timeout=%g,entry_timeout=%g,negative_timeout=%g",
+			 cache_timeout, cache_timeout, cache_timeout);
+	if (fuse_opt_insert_arg(&args, 1, timeouts) == -1)
+	{
+		LOG_ERROR("Couldn't set the cache timeouts\n");
+		return 1;
 	}
 
-	return fuse_main(new_argc, new_argv, &ops, NULL);
+	return fuse_main(args.argc, args.argv, &ops, NULL);
 
 }
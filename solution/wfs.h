@@ -1,9 +1,24 @@
 #include <time.h>
 #include <sys/stat.h>
 
-#define BLOCK_SIZE (512)
+#define BLOCK_SIZE (512)   // Default data block size, and the size of each inode slot
+#define MAX_BLOCK_SIZE (65536)
 #define MAX_NAME   (28)
 
+#define RAID_1V    (2) // raid_mode of verified mirroring, laid out like RAID 1
+
+#define INODE_CLASSIC (0) // Inode format mapping through blocks[], direct and indirect
+#define INODE_EXTENT  (1) // Inode format mapping through extents kept in the inode slack
+#define INODE_INDIRECT3 (2) // Classic plus double and triple indirect blocks kept in the inode slack
+#define INODE_INLINE  (3) // File data kept in the inode slack, until it outgrows it
+#define INODE_HASHED_DIR (4) // Directory whose entries are found through a hash index, see struct wfs_dir_index
+#define INODE_INDIRECT_DIR (5) // Directory with an indirect block at blocks[IND_BLOCK], older ones use it as an eighth direct block
+
+#define JOURNAL_PTR (BLOCK_SIZE) // The journal, when there is one, starts on the block after the superblock
+#define JOURNAL_HEADER (0x4a534657) // Magic of the journal's first block
+#define JOURNAL_DESC   (0x44534657) // Magic of a descriptor block
+#define JOURNAL_COMMIT (0x43534657) // Magic of a commit block
+
 #define D_BLOCK    (6)
 #define IND_BLOCK  (D_BLOCK+1)
 #define N_BLOCKS   (IND_BLOCK+1)
@@ -21,6 +36,8 @@
 0    ^                   ^
 i_bitmap_ptr        i_blocks_ptr
 
+  With a journal, journal_blocks blocks of BLOCK_SIZE sit between the
+  superblock and the inode bitmap, starting at JOURNAL_PTR.
 */
 
 // Superblock
@@ -35,6 +52,11 @@ struct wfs_sb {
 	int raid_mode;
 	int total_disks;
 	int disk_order;
+	int block_size; // Data block size chosen at mkfs time, a power of two
+	int inode_format; // INODE_* given to new regular files
+	int inline_data;  // New regular files start INODE_INLINE
+	int dir_index;    // New directories are INODE_HASHED_DIR
+	int journal_blocks; // BLOCK_SIZE blocks of metadata journal at JOURNAL_PTR, 0 for none
 };
 
 // Inode
@@ -58,3 +80,102 @@ struct wfs_dentry {
     char name[MAX_NAME];
     int num;
 };
+
+/*
+  Every inode owns a BLOCK_SIZE slot, struct wfs_inode only fills the front
+  of it. The slack after it starts with struct wfs_inode_ext. Slack that is
+  all zeroes is a classic inode, which keeps images from before inode formats
+  mountable.
+
+  An inline inode keeps the file's bytes after the header. Once a write would
+  not fit it moves them to a data block and takes the filesystem's format.
+
+  An indirect3 inode keeps struct wfs_inode_indirect after the header, the
+  blocks under its double and then triple indirect trees follow the ones under
+  blocks[IND_BLOCK].
+
+  An extent inode keeps its records right after the header. At depth 0 they
+  are the file's extents. At depth 1 each record indexes a leaf block
+  (lblk is the first logical block the leaf covers, pblk the leaf's entry)
+  and the leaves hold the extents.
+*/
+struct wfs_inode_ext {
+    int format;   /* INODE_* this inode is mapped with */
+    int depth;    /* Extent tree depth */
+    int count;    /* Records in use after the header */
+    unsigned int generation; /* Bumped each time the inode number is handed out, kept while it's free */
+};
+
+struct wfs_inode_indirect {
+    off_t dind;   /* Double indirect block */
+    off_t tind;   /* Triple indirect block */
+};
+
+// len blocks of a file starting at logical block lblk, pblk is the entry of the first
+struct wfs_extent {
+    int lblk;
+    int len;
+    off_t pblk;
+};
+
+// Extent tree leaf, fills a data block
+struct wfs_extent_leaf {
+    int count;
+    int unused[3];
+    struct wfs_extent extents[];
+};
+
+/*
+  A hashed directory keeps struct wfs_dir_index in its first block. Bucket i
+  holds the entries whose name hash is at least buckets[i].hash and below the
+  next bucket's, all in directory block buckets[i].block. A full bucket splits
+  at the median hash of its entries into a new block. The count in the
+  directory inode's slack header is the number of directory blocks in use.
+*/
+struct wfs_dir_bucket {
+    unsigned int hash;  /* Lowest name hash in the bucket */
+    int block;          /* Directory block holding the bucket's entries */
+};
+
+struct wfs_dir_index {
+    int count;    /* Buckets in use */
+    int unused[3];
+    struct wfs_dir_bucket buckets[];
+};
+
+/*
+  The metadata journal is a redo log kept in disk 0's journal region. Its
+  first block is struct wfs_journal_header. A transaction is one or more
+  descriptor blocks, each followed by the BLOCK_SIZE images of the blocks its
+  tags name, then a commit block whose checksum covers those images. Mount
+  replays committed transactions from start on, for as long as their
+  sequence numbers follow each other.
+*/
+struct wfs_journal_header {
+    unsigned int magic;     /* JOURNAL_HEADER */
+    unsigned int sequence;  /* Sequence of the transaction at start */
+    int start;              /* Journal block the log starts at */
+    int unused;
+};
+
+// Where a logged block goes
+struct wfs_journal_tag {
+    int disk;
+    int unused;
+    off_t offset; /* Offset into the disk image, a multiple of BLOCK_SIZE */
+};
+
+struct wfs_journal_desc {
+    unsigned int magic;     /* JOURNAL_DESC */
+    unsigned int sequence;
+    int count;              /* Tags in this descriptor */
+    int unused;
+    struct wfs_journal_tag tags[];
+};
+
+struct wfs_journal_commit {
+    unsigned int magic;     /* JOURNAL_COMMIT */
+    unsigned int sequence;
+    int count;              /* Blocks in the transaction */
+    unsigned int checksum;  /* crc32c of the logged images, in order */
+};
@@ -230,15 +230,17 @@ It removes the test disks."
   (format "fusermount -uq mnt; rm -f %s"
 	  (disk-path "test-disk*")))
 
-(defun mount-cmd (numdisks dir)
+(defun mount-cmd (numdisks dir &optional opts)
   "Mount wfs using NUMDISKS disks in single-threaded mode on DIR.
 
 NUMDISKS the number of disks used for testing
-DIR the mount directory"
+DIR the mount directory
+OPTS extra wfs options, such as \"-o lowlevel\""
   (make-directory dir :parents)
   (format
-   "../solution/wfs %s -s %s"
+   "../solution/wfs %s -s %s%s"
    (string-join (gen-disks numdisks) " ")
+   (if opts (concat opts " ") "")
    dir))
 
 (defun umount-cmd (dir)
@@ -343,6 +345,52 @@ OUTPUT the expected output. Generally \"Correct\" or an error."
    output
    "0" rc "")) ; pre-rc should always be 0
 
+(defun format-setup-cmd (numdisks raid inodes blocks flags mount-opts)
+  "The pre command for tests of a filesystem made with extra mkfs FLAGS.
+
+Like setup-cmd, but formats with INODES and BLOCKS and mounts with
+MOUNT-OPTS."
+  (string-join
+   (list
+    "mkdir -p mnt; mkdir -p /tmp/$(whoami)"
+    (create-disk-cmd numdisks "1M")
+    (format "../solution/mkfs %s %s" (make-mkfs-args raid numdisks inodes blocks) flags)
+    (mount-cmd numdisks "mnt" mount-opts))
+   " && "))
+
+(defun format-and-workload
+    (desc inodes blocks flags mount-opts op used-blocks dirs files raid numdisks output rc)
+  "Test template for a workload on a filesystem made with extra mkfs FLAGS.
+
+Block sizes, inode formats, inline data and directory indexes change
+how many data blocks a workload allocates, so the test gives the count
+the metadata verifier expects instead of deriving it from a fs state.
+
+DESC test description.
+INODES BLOCKS the mkfs inode and data block counts.
+FLAGS extra mkfs arguments, e.g. \"-f extent\".
+MOUNT-OPTS extra wfs options, or nil.
+OP the workload, run on the mounted filesystem.
+USED-BLOCKS DIRS FILES what the verifier should find after OP.
+RAID raid mode as string (0, 1, or 1v)
+NUMDISKS the number of disks to create.
+OUTPUT the expected output. Generally \"Correct\" or an error."
+  (define-test
+   desc
+   (format-setup-cmd numdisks raid inodes blocks flags mount-opts)
+   (teardown-cmd)
+   (string-join
+    (list
+     op
+     (umount-cmd "mnt")
+     (format
+      "./wfs-check-metadata.py --mode raid%s --blocks %d --altblocks %d --dirs %d --files %d --disks %s"
+      raid used-blocks used-blocks dirs files
+      (string-join (gen-disks numdisks) " ")))
+    " && ")
+   output
+   "0" rc ""))
+
 (defun n-file-directory (n sz)
   (if (= n 0)
       nil
@@ -503,4 +551,185 @@ POST-BLOCKS additional blocks we should expect (e.g. no cleaning dir blocks)"
 			  (mount-cmd 3 "mnt")
 			  "diff mnt/file1 file1.test")
 		    "; ")
-		  ,'(("file1" . 1000)) 0 "1v" 3 "Correct\nCorrect\nCorrect" 0))))))
+		  ,'(("file1" . 1000)) 0 "1v" 3 "Correct\nCorrect\nCorrect" 0)
+		 ("raid1 -- replay the journal after wfs is killed mid-batch" ,'()
+		  ,(string-join
+		    (list "fusermount -u mnt"
+			  (concat "../solution/mkfs " (default-fs-mkfs-args "1" 2) " -J 64 > /dev/null")
+			  (mount-cmd 2 "mnt")
+			  "./read-write.py 1 10"
+			  "cat mnt/file1 > file1.test"
+			  "./kill-mid-batch.py 2 4 4" ; file2-file5 are fsynced, file6-file9 are not
+			  "fusermount -uzq mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test"
+			  "./readdir-check.py 5")
+		    "; ")
+		  ,'(("file1" . 1000) ("file2" . 0) ("file3" . 0) ("file4" . 0) ("file5" . 0))
+		  0 "1" 2 "Correct\nCorrect\nCorrect\nCorrect\nCorrect" 0))))
+   ((testcase . ,#'format-and-workload)
+;;    (desc inodes blocks flags mount-opts op used-blocks dirs files raid numdisks output rc)
+    (configs . (("raid1 -- 4096 byte blocks, readback after remount" 32 200 "-B 4096" nil
+		  ,(string-join
+		    (list "./read-write.py 1 100" ; 10000 bytes, three blocks
+			  "cat mnt/file1 > file1.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test")
+		    "; ")
+		  4 1 1 "1" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- extent-mapped files, readback after remount" 32 200 "-f extent" nil
+		  ,(string-join
+		    (list "./read-write.py 2 80"
+			  "cat mnt/file1 > file1.test"
+			  "cat mnt/file2 > file2.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test"
+			  "diff mnt/file2 file2.test")
+		    "; ")
+		  33 1 2 "1" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- double indirect blocks, readback after remount" 32 400 "-f indirect3" nil
+		  ,(string-join
+		    (list "./read-write.py 1 400" ; 40000 bytes, past the single indirect block
+			  "cat mnt/file1 > file1.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test")
+		    "; ")
+		  83 1 1 "1" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- inline files, promoted when they outgrow the inode" 32 200 "-I" nil
+		  ,(string-join
+		    (list "head -c 300 /dev/urandom > file1.test" ; fits in the inode
+			  "head -c 1000 /dev/urandom > file2.test" ; starts inline, then needs blocks
+			  "cp file1.test mnt/file1"
+			  "head -c 200 file2.test > mnt/file2"
+			  "tail -c 800 file2.test >> mnt/file2"
+			  "diff mnt/file2 file2.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test"
+			  "diff mnt/file2 file2.test")
+		    "; ")
+		  3 1 2 "1" 2 "Correct" 0)
+		 ("raid1 -- hashed directory index past the direct blocks" 128 200 "-H" nil
+		  ,(string-join
+		    (list "python3 -c 'import os\nfor n in range(120): os.mknod(\"mnt/file%d\" % (n + 1))'"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "./readdir-check.py 120"
+			  "stat -c %s mnt/file120")
+		    "; ")
+		  14 1 120 "1" 2 "Correct\n0\nCorrect" 0)
+		 ("raid1v -- two disks disagree, the first mounted wins" 32 200 "" nil
+		  ,(string-join
+		    (list "./read-write.py 1 10"
+			  "cat mnt/file1 > file1.test"
+			  "fusermount -u mnt"
+			  (format "./corrupt-disk.py --disks %s"
+				  (disk-path "test-disk1"))
+			  (format "../solution/wfs %s %s -s mnt"
+				  (disk-path "test-disk2") (disk-path "test-disk1"))
+			  "diff mnt/file1 file1.test")
+		    "; ")
+		  3 1 1 "1v" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- unlink open files, reclaim orphans at mount" 32 200 "" nil
+		  ,(string-join
+		    (list "./unlink-open.py --bytes 2000" ; freed on close
+			  "./unlink-open.py --bytes 2000 --kill" ; still open when wfs dies
+			  "fusermount -uzq mnt"
+			  (mount-cmd 2 "mnt")
+			  "./readdir-check.py 0")
+		    "; ")
+		  1 1 0 "1" 2 "Correct\nCorrect\nCorrect\nCorrect" 0)
+		 ("raid1 -- low-level backend" 32 200 "" "-o lowlevel"
+		  ,(string-join
+		    (list "./read-write.py 3 80"
+			  "rm mnt/file3"
+			  "./readdir-check.py 2"
+			  "cat mnt/file1 > file1.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt" "-o lowlevel")
+			  "diff mnt/file1 file1.test")
+		    "; ")
+		  35 1 2 "1" 2 "Correct\nCorrect\nCorrect" 0)
+		 ("raid1 -- operation stats in /.wfs_stats" 32 200 "" nil
+		  ,(string-join
+		    (list "./read-write.py 1 10" ; 1000 bytes written
+			  "./stats-check.py write 1000")
+		    "; ")
+		  3 1 1 "1" 2 "Correct\nCorrect\nCorrect" 0)
+		 ("raid1 -- mount images made by the original mkfs" 32 200 "" nil
+		  ,(string-join
+		    (list "fusermount -u mnt"
+			  (format "./mkfs-original.py %s"
+				  (make-mkfs-args "1" 2 32 200))
+			  (mount-cmd 2 "mnt")
+			  "./read-write.py 2 80"
+			  "cat mnt/file1 > file1.test"
+			  "cat mnt/file2 > file2.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test"
+			  "diff mnt/file2 file2.test")
+		    "; ")
+		  35 1 2 "1" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- original image, directory past seven blocks" 128 200 "" nil
+		  ,(string-join
+		    (list "fusermount -u mnt"
+			  (format "./mkfs-original.py %s"
+				  (make-mkfs-args "1" 2 128 200))
+			  (mount-cmd 2 "mnt")
+			  "python3 -c 'import os\nfor n in range(120): os.mknod(\"mnt/file%d\" % (n + 1))'"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "./readdir-check.py 120"
+			  "python3 -c 'import os\nfor n in range(60, 120): os.unlink(\"mnt/file%d\" % (n + 1))'"
+			  "./readdir-check.py 60")
+		    "; ")
+		  8 1 60 "1" 2 "Correct\nCorrect\nCorrect" 0)
+		 ("raid0 -- mkfs size check counts data region padding" 32 200 "" nil
+		  ,(string-join
+		    (list "fusermount -u mnt"
+			  (create-disk-cmd 2 "2113537") ; past the blocks, not the padding
+			  (format "../solution/mkfs %s -B 65536 > /dev/null"
+				  (make-mkfs-args "0" 2 32 32))
+			  "echo $?"
+			  (create-disk-cmd 2 "2162688")
+			  (format "../solution/mkfs %s -B 65536"
+				  (make-mkfs-args "0" 2 32 32))
+			  (mount-cmd 2 "mnt")
+			  "./read-write.py 1 10"
+			  "cat mnt/file1 > file1.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test")
+		    "; ")
+		  2 1 1 "0" 2 "255\nCorrect\nCorrect" 0)
+		 ("raid1 -- low-level backend, removed inode reused" 32 200 "" "-o lowlevel"
+		  ,(string-join
+		    (list "./read-write.py 3 80"
+			  "cat mnt/file3 > /dev/null" ; cached under its node id
+			  "rm mnt/file3"
+			  "head -c 700 /dev/urandom > file3.test"
+			  "cp file3.test mnt/file3" ; same inode, next generation
+			  "diff mnt/file3 file3.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt" "-o lowlevel")
+			  "diff mnt/file3 file3.test")
+		    "; ")
+		  37 1 3 "1" 2 "Correct\nCorrect" 0)
+		 ("raid1 -- double indirect file removed after a read, inode reused" 32 400 "-f indirect3" nil
+		  ,(string-join
+		    (list "./read-write.py 2 400" ; reading back fills the mapping cache
+			  "rm mnt/file1"
+			  "head -c 30000 /dev/urandom > file1.test"
+			  "cp file1.test mnt/file1"
+			  "cat mnt/file2 > file2.test"
+			  "diff mnt/file1 file1.test"
+			  "fusermount -u mnt"
+			  (mount-cmd 2 "mnt")
+			  "diff mnt/file1 file1.test"
+			  "diff mnt/file2 file2.test")
+		    "; ")
+		  143 1 2 "1" 2 "Correct\nCorrect" 0))))))
@@ -0,0 +1,36 @@
+#!/usr/bin/python3
+
+# create files in two batches, fsync after the first so its transaction
+# commits, then SIGKILL wfs before the second one does. only the first
+# batch may be there when the disks are mounted again
+
+import os
+import sys
+import wfsmount
+
+first = int(sys.argv[1])
+numfirst = int(sys.argv[2])
+numsecond = int(sys.argv[3])
+firstlist = ["file" + str(n + first) for n in range(numfirst)]
+secondlist = ["file" + str(n + first + numfirst) for n in range(numsecond)]
+
+pid = wfsmount.find_wfs()
+if pid is None:
+    print("wfs is not running")
+    exit(1)
+
+os.chdir("mnt")
+
+for name in firstlist:
+    os.mknod(name)
+fd = os.open(firstlist[-1], os.O_RDONLY)
+os.fsync(fd)
+os.close(fd)
+
+for name in secondlist:
+    os.mknod(name)
+
+wfsmount.kill_wfs(pid)
+
+print("Correct")
+exit(0)
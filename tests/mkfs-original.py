@@ -0,0 +1,44 @@
+#!/usr/bin/python3
+
+# format disks the way the original mkfs did, before any of the optional
+# layouts: a 64 byte superblock with the inode bitmap right after it, no
+# block size or format fields, and a root inode with zeroed slack
+
+import argparse
+import os
+import struct
+import time
+
+def roundup(n, k):
+    """Roundup n by k."""
+    remain = n % k
+    return n if remain == 0 else (n + (k - remain))
+
+def format_disk(disk, order, raid, numdisks, inodes, blocks):
+    """Write the original superblock, root inode and inode bitmap."""
+    ibit = 64
+    dbit = ibit + inodes // 8
+    iblocks = roundup(dbit + blocks // 8, 512)
+    dblocks = iblocks + 512 * inodes
+    now = int(time.time())
+
+    with open(disk, "r+b") as diskf:
+        diskf.write(struct.pack("<QQqqqqiii4x", inodes, blocks, ibit, dbit,
+                                iblocks, dblocks, raid, numdisks, order))
+        diskf.write(bytes([1]) + bytes(inodes // 8 - 1))
+        diskf.seek(iblocks)
+        diskf.write(struct.pack("<iIIIqq3q8q", 0, 0o40700, os.getuid(),
+                                os.getgid(), 0, 1, now, now, now, *[-1] * 8))
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-r", type=int, help="raid mode, 0 or 1")
+    parser.add_argument("-d", action="append", help="disk image, once per disk")
+    parser.add_argument("-i", type=int, help="number of inodes")
+    parser.add_argument("-b", type=int, help="number of data blocks")
+
+    args = parser.parse_args()
+
+    for order, disk in enumerate(args.d):
+        format_disk(disk, order + 1, args.r, len(args.d),
+                    roundup(args.i, 32), roundup(args.b, 32))
@@ -0,0 +1,40 @@
+#!/usr/bin/python3
+
+# check an operation's row in /.wfs_stats, and that the stats file is
+# readable but neither listed nor removable
+
+import errno
+import os
+import sys
+
+op = sys.argv[1]
+numbytes = int(sys.argv[2])
+
+with open("mnt/.wfs_stats") as f:
+    rows = [line.split() for line in f]
+
+header = rows[0]
+found = [row for row in rows[1:] if row and row[0] == op]
+if not found:
+    print(f"no {op} row in stats")
+    exit(1)
+row = dict(zip(header, found[0]))
+if int(row["count"]) < 1 or int(row["bytes"]) != numbytes:
+    print(f"{op} stats: count {row['count']} bytes {row['bytes']}, expected {numbytes} bytes")
+    exit(1)
+
+if ".wfs_stats" in os.listdir("mnt"):
+    print("stats file listed by readdir")
+    exit(1)
+
+try:
+    os.unlink("mnt/.wfs_stats")
+    print("stats file removed")
+    exit(1)
+except OSError as e:
+    if e.errno != errno.EACCES:
+        print(e)
+        exit(1)
+
+print("Correct")
+exit(0)
@@ -0,0 +1,43 @@
+#!/usr/bin/python3
+
+# unlink a file while it is open and read it back through the open file.
+# with --kill wfs is SIGKILLed before the file is closed, leaving an
+# orphan for the next mount to reclaim
+
+import argparse
+import os
+import wfsmount
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--bytes", type=int, help="bytes to write")
+parser.add_argument("--kill", action="store_true", help="kill wfs with the file open")
+args = parser.parse_args()
+
+pid = wfsmount.find_wfs()
+if pid is None:
+    print("wfs is not running")
+    exit(1)
+
+data = os.urandom(args.bytes)
+
+os.chdir("mnt")
+
+with open("file1", "wb") as f:
+    f.write(data)
+
+f = open("file1", "rb")
+os.unlink("file1")
+if "file1" in os.listdir("."):
+    print("file1 still listed after unlink")
+    exit(1)
+if f.read() != data:
+    print("file1 readback after unlink does not match data written")
+    exit(1)
+
+if args.kill:
+    wfsmount.kill_wfs(pid)
+else:
+    f.close()
+
+print("Correct")
+exit(0)
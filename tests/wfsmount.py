@@ -0,0 +1,23 @@
+import os
+import signal
+import time
+
+def find_wfs():
+    """Return the pid of the wfs process mounted on mnt."""
+    for pid in os.listdir("/proc"):
+        if not pid.isdigit():
+            continue
+        try:
+            with open(f"/proc/{pid}/cmdline", "rb") as f:
+                args = f.read().split(b"\0")[:-1]
+        except OSError:
+            continue
+        if args and args[0].endswith(b"wfs") and args[-1] == b"mnt":
+            return int(pid)
+    return None
+
+def kill_wfs(pid):
+    """SIGKILL wfs and wait until it is gone, so nothing else reaches the disks."""
+    os.kill(pid, signal.SIGKILL)
+    while os.path.exists(f"/proc/{pid}"):
+        time.sleep(0.1)